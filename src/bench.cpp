@@ -0,0 +1,570 @@
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "tensor.hpp"
+#include "tensor_expr.hpp"
+#include "nn.hpp"
+#include "compile.hpp"
+#include "trainer.hpp"
+#include "static_mlp.hpp"
+#include "inference_server.hpp"
+#include "quantize.hpp"
+
+// Usage: bench [--json <file>] [suite...]
+// Prints a table per suite, and with --json also writes every result (one object per
+// suite/case with its metrics) for tracking regressions across releases.
+// Suites: matmul, elementwise, reduction, graph, mlp, inference, server, compile, dataparallel, quantize (default: all)
+
+// Set by the build from the project version
+#ifndef VERYSMALLGRAD_VERSION
+#define VERYSMALLGRAD_VERSION "unknown"
+#endif
+
+// Heap allocations made by the process, counted by the global operator new replaced in bench_alloc.cpp
+extern std::atomic<size_t> allocationCount;
+
+struct Measurement {
+  // Averages per call
+  double seconds;
+  double allocations;
+};
+
+// Runs 'fn' repeatedly for at least the given duration, averaging its time and allocations per call
+template<typename Func>
+Measurement measure(Func&& fn, double minSeconds = 0.25)
+{
+  using Clock = std::chrono::steady_clock;
+  fn();
+  size_t iterations = 0;
+  const auto allocations = allocationCount.load();
+  const auto start = Clock::now();
+  std::chrono::duration<double> elapsed{};
+  do {
+    fn();
+    ++iterations;
+    elapsed = Clock::now() - start;
+  } while (elapsed.count() < minSeconds);
+  return { elapsed.count() / iterations, double(allocationCount.load() - allocations) / iterations };
+}
+
+template<typename Func>
+double timeIt(Func&& fn, double minSeconds = 0.25)
+{
+  return measure(fn, minSeconds).seconds;
+}
+
+struct Result {
+  std::string suite;
+  std::string name;
+  std::vector<std::pair<std::string, double>> metrics;
+};
+std::vector<Result> results;
+
+void record(std::string suite, std::string name, std::vector<std::pair<std::string, double>> metrics)
+{
+  results.push_back({ std::move(suite), std::move(name), std::move(metrics) });
+}
+
+void writeJson(std::ostream& out)
+{
+  out << "{\n  \"version\": \"" << VERYSMALLGRAD_VERSION << "\",\n  \"compiler\": \"" << __VERSION__ << "\",\n  \"results\": [";
+  for (size_t i=0; i<results.size(); ++i) {
+    const auto& r = results[i];
+    out << (i ? "," : "") << "\n    { \"suite\": \"" << r.suite << "\", \"name\": \"" << r.name << "\", \"metrics\": {";
+    for (size_t j=0; j<r.metrics.size(); ++j) {
+      out << (j ? ", " : " ") << '"' << r.metrics[j].first << "\": " << std::setprecision(9) << std::defaultfloat << r.metrics[j].second;
+    }
+    out << " } }";
+  }
+  out << "\n  ]\n}\n";
+}
+
+std::string shapeName(const std::vector<size_t>& layers)
+{
+  std::string name;
+  for (auto l : layers) {
+    name += (name.empty() ? "" : "-") + std::to_string(l);
+  }
+  return name;
+}
+
+// Blocked kernel throughput by element type (reduced precision types accumulate in float)
+template<typename T>
+void matmulTypeBench(const char* name)
+{
+  for (size_t size : { 256, 1000 }) {
+    const auto a = BasicTensor<T>::random({ size, size });
+    const auto b = BasicTensor<T>::random({ size, size });
+    const auto m = measure([&]() { auto c = a.matmul(b); });
+    const auto gflops = 2.0 * size * size * size / m.seconds / 1e9;
+    std::cout << std::setw(10) << name << std::setw(12) << size
+      << std::setw(12) << std::fixed << std::setprecision(2) << gflops << std::endl;
+    record("matmul", std::string("Tensor<") + name + ">::matmul " + std::to_string(size),
+      { { "ns_per_op", m.seconds * 1e9 }, { "gflops", gflops }, { "allocs_per_op", m.allocations } });
+  }
+}
+
+void matmulBench()
+{
+  std::cout << "matmul (GFLOP/s)" << std::endl;
+  std::cout << std::setw(22) << "m x n x k" << std::setw(12) << "reference" << std::setw(12) << "blocked" << std::setw(10) << "speedup" << std::endl;
+  const auto shapes = std::vector<std::array<size_t, 3>>{
+    { 64, 64, 64 }, { 256, 256, 256 }, { 512, 512, 512 }, { 1000, 1000, 1000 },
+    { 1, 1000, 1000 }, { 1000, 1, 1000 }, { 1000, 1000, 1 }, { 4096, 16, 16 }, { 16, 4096, 16 }, { 16, 16, 4096 }
+  };
+  for (auto [m, n, k] : shapes) {
+    std::vector<double> a(m*k);
+    std::vector<double> b(k*n);
+    std::vector<double> c(m*n);
+    for (auto& d : a) { d = (double)rand() / RAND_MAX; }
+    for (auto& d : b) { d = (double)rand() / RAND_MAX; }
+    const auto flops = 2.0 * m * n * k;
+    const auto reference = timeIt([&]() {
+      kernels::gemmReference(m, n, k, a.data(), k, b.data(), n, c.data(), n);
+    });
+    const auto blocked = timeIt([&]() {
+      kernels::gemm(m, n, k, a.data(), k, b.data(), n, c.data(), n);
+    });
+    std::stringstream shape;
+    shape << m << " x " << n << " x " << k;
+    std::cout << std::setw(22) << shape.str()
+      << std::setw(12) << std::fixed << std::setprecision(2) << flops / reference / 1e9
+      << std::setw(12) << flops / blocked / 1e9
+      << std::setw(9) << reference / blocked << 'x' << std::endl;
+    record("matmul", "gemm " + shape.str(),
+      { { "ns_per_op", blocked * 1e9 }, { "gflops", flops / blocked / 1e9 }, { "reference_gflops", flops / reference / 1e9 } });
+  }
+
+  std::cout << "Tensor::matmul by element type (GFLOP/s)" << std::endl;
+  std::cout << std::setw(10) << "type" << std::setw(12) << "n" << std::setw(12) << "GFLOP/s" << std::endl;
+  matmulTypeBench<double>("double");
+  matmulTypeBench<float>("float");
+  matmulTypeBench<bfloat16>("bfloat16");
+  matmulTypeBench<float16>("float16");
+}
+
+void elementwiseBench()
+{
+  std::cout << "(t1 + t2) * 2 - t3 (ns/element)" << std::endl;
+  std::cout << std::setw(22) << "elements" << std::setw(12) << "eager" << std::setw(12) << "fused" << std::setw(10) << "speedup" << std::endl;
+  for (size_t size : { 1000, 100000, 10000000 }) {
+    const auto t1 = Tensor::random({ size });
+    const auto t2 = Tensor::random({ size });
+    const auto t3 = Tensor::random({ size });
+    const auto eager = measure([&]() {
+      auto result = (t1 + t2) * 2.0 - t3;
+    });
+    const auto fused = measure([&]() {
+      Tensor result = (expr::lazy(t1) + t2) * 2.0 - t3;
+    });
+    std::cout << std::setw(22) << size
+      << std::setw(12) << std::fixed << std::setprecision(3) << eager.seconds / size * 1e9
+      << std::setw(12) << fused.seconds / size * 1e9
+      << std::setw(9) << std::setprecision(2) << eager.seconds / fused.seconds << 'x' << std::endl;
+    for (const auto& [name, m] : { std::pair{ "eager", eager }, std::pair{ "fused", fused } }) {
+      record("elementwise", std::string(name) + " " + std::to_string(size),
+        { { "ns_per_op", m.seconds * 1e9 }, { "ns_per_element", m.seconds / size * 1e9 }, { "allocs_per_op", m.allocations } });
+    }
+  }
+}
+
+// Full and axis reductions against a serial running total
+void reductionBench()
+{
+  std::cout << "Tensor reductions, 1000 x 1000 (ns/element)" << std::endl;
+  std::cout << std::setw(22) << "reduction" << std::setw(12) << "ns/element" << std::endl;
+  const auto t = Tensor::random({ 1000, 1000 });
+  double sink = 0.0;
+  const auto reductions = std::vector<std::pair<std::string, std::function<void()>>>{
+    { "serial loop", [&]() { for (auto d : t.data()) { sink += d; } } },
+    { "sum()", [&]() { sink += t.sum(); } },
+    { "sum(0)", [&]() { sink += t.sum(0).data()[0]; } },
+    { "sum(1)", [&]() { sink += t.sum(1).data()[0]; } },
+    { "max(1)", [&]() { sink += t.max(1).data()[0]; } },
+    { "logsumexp(1)", [&]() { sink += t.logsumexp(1).data()[0]; } }
+  };
+  for (const auto& [name, fn] : reductions) {
+    const auto m = measure(fn);
+    std::cout << std::setw(22) << name << std::setw(12) << std::fixed << std::setprecision(3) << m.seconds / t.size() * 1e9
+      << (sink == 0.123 ? " " : "") << std::endl;
+    record("reduction", name + " 1000x1000", { { "ns_per_op", m.seconds * 1e9 }, { "ns_per_element", m.seconds / t.size() * 1e9 } });
+  }
+}
+
+// Scalar graphs: recording (and tearing down) a chain of nodes, and backpropagating through it
+void graphBench()
+{
+  std::cout << "Value graph of a multiply-add chain (ns/node)" << std::endl;
+  std::cout << std::setw(22) << "nodes" << std::setw(12) << "build" << std::setw(12) << "backwards" << std::setw(12) << "allocs/node" << std::endl;
+  for (size_t nodes : { 1000, 100000 }) {
+    const auto w = Value::make(0.999);
+    const auto b = Value::make(0.001);
+    auto chain = [&]() {
+      auto x = Value::make(1.0);
+      for (size_t i=0; i<nodes; i+=2) {
+        x = x * w + b;
+      }
+      return x;
+    };
+    const auto build = measure([&]() { chain(); });
+    const auto root = chain();
+    const auto backwards = measure([&]() { root->backwards(); });
+    std::cout << std::setw(22) << nodes
+      << std::setw(12) << std::fixed << std::setprecision(2) << build.seconds / nodes * 1e9
+      << std::setw(12) << backwards.seconds / nodes * 1e9
+      << std::setw(12) << build.allocations / nodes << std::endl;
+    record("graph", "build " + std::to_string(nodes),
+      { { "ns_per_op", build.seconds * 1e9 }, { "nodes_per_sec", nodes / build.seconds }, { "allocs_per_op", build.allocations } });
+    record("graph", "Value::backwards " + std::to_string(nodes),
+      { { "ns_per_op", backwards.seconds * 1e9 }, { "nodes_per_sec", nodes / backwards.seconds }, { "allocs_per_op", backwards.allocations } });
+  }
+}
+
+// MultilayerPerceptron forward and SGD training steps, scalar graphs and tensors
+void mlpBench()
+{
+  std::cout << "MultilayerPerceptron, 8 samples (us/op)" << std::endl;
+  std::cout << std::setw(22) << "layers" << std::setw(12) << "forward" << std::setw(12) << "train step" << std::setw(12) << "allocs/step" << std::endl;
+  for (const auto& layers : { std::vector<size_t>{ 4, 8, 8, 1 }, std::vector<size_t>{ 16, 32, 32, 1 }, std::vector<size_t>{ 64, 128, 128, 10 } }) {
+    const auto mlp = MultilayerPerceptron(layers);
+    const auto params = mlp.parameters();
+    std::vector<std::vector<ValuePtr>> xs(8);
+    std::vector<ValuePtr> ys;
+    for (auto& x : xs) {
+      for (size_t i=0; i<layers.front(); ++i) {
+        x.push_back(Value::make((double)rand() / RAND_MAX));
+      }
+      ys.push_back(Value::make(1.0));
+    }
+    const auto forward = measure([&]() {
+      for (auto& x : xs) {
+        mlp(x);
+      }
+    });
+    const auto step = measure([&]() {
+      auto loss = Value::make(0.0);
+      for (size_t i=0; i<xs.size(); ++i) {
+        loss = loss + squaredError(mlp(xs[i]).front(), ys[i]);
+      }
+      loss->backwards();
+      for (auto& p : params) {
+        p->_value -= 1e-6 * p->_grad;
+        p->_grad = 0.0;
+      }
+    });
+    const auto name = shapeName(layers);
+    std::cout << std::setw(22) << name
+      << std::setw(12) << std::fixed << std::setprecision(2) << forward.seconds * 1e6
+      << std::setw(12) << step.seconds * 1e6
+      << std::setw(12) << std::setprecision(0) << step.allocations << std::endl;
+    record("mlp", "MultilayerPerceptron forward " + name,
+      { { "ns_per_op", forward.seconds * 1e9 }, { "allocs_per_op", forward.allocations } });
+    record("mlp", "MultilayerPerceptron train step " + name,
+      { { "ns_per_op", step.seconds * 1e9 }, { "allocs_per_op", step.allocations } });
+  }
+
+  std::cout << "TensorMultilayerPerceptron train step, batch 64 (us/step)" << std::endl;
+  std::cout << std::setw(22) << "layers" << std::setw(12) << "step" << std::setw(12) << "GFLOP/s" << std::setw(12) << "allocs/step" << std::endl;
+  for (const auto& layers : { std::vector<size_t>{ 64, 128, 128, 10 }, std::vector<size_t>{ 256, 512, 512, 10 } }) {
+    auto model = TensorMultilayerPerceptron(layers);
+    auto optimizer = SGD(1e-4);
+    const auto inputs = Tensor::random({ 64, layers.front() });
+    const auto targets = Tensor::random({ 64, layers.back() });
+    const auto step = measure([&]() {
+      model.backwards(inputs, targets);
+      optimizer.step(model.parameterBuffer());
+    });
+    // Forward, input gradient and weight gradient products: 3 matmuls of 2 * batch * weights flops
+    double weights = 0.0;
+    for (size_t i=0; i+1<layers.size(); ++i) {
+      weights += double(layers[i]) * layers[i+1];
+    }
+    const auto gflops = 6.0 * 64 * weights / step.seconds / 1e9;
+    const auto name = shapeName(layers);
+    std::cout << std::setw(22) << name
+      << std::setw(12) << std::fixed << std::setprecision(2) << step.seconds * 1e6
+      << std::setw(12) << gflops
+      << std::setw(12) << std::setprecision(0) << step.allocations << std::endl;
+    record("mlp", "TensorMultilayerPerceptron train step " + name,
+      { { "ns_per_op", step.seconds * 1e9 }, { "gflops", gflops }, { "allocs_per_op", step.allocations } });
+  }
+}
+
+// Single sample latency: recording a graph per call vs the inference only path
+void inferenceBench()
+{
+  std::cout << "MLP single sample forward (us/sample)" << std::endl;
+  std::cout << std::setw(22) << "layers" << std::setw(12) << "graph" << std::setw(12) << "infer" << std::setw(10) << "speedup" << std::endl;
+  for (const auto& layers : { std::vector<size_t>{ 3, 4, 4, 1 }, std::vector<size_t>{ 64, 128, 128, 10 } }) {
+    const auto mlp = MultilayerPerceptron(layers);
+    std::vector<double> input(layers.front(), 0.5);
+    std::vector<ValuePtr> values;
+    for (auto d : input) {
+      values.push_back(Value::make(d));
+    }
+    double sink = 0.0;
+    const auto graph = measure([&]() { sink += mlp(values).front()->_value; });
+    MultilayerPerceptron::InferenceBuffers buffers;
+    const auto infer = measure([&]() { sink += mlp.infer(input, buffers).front(); });
+    std::cout << std::setw(22) << (std::to_string(layers.front()) + "-" + std::to_string(layers[1]) + "-" + std::to_string(layers.back()))
+      << std::setw(12) << std::fixed << std::setprecision(3) << graph.seconds * 1e6
+      << std::setw(12) << infer.seconds * 1e6
+      << std::setw(9) << std::setprecision(2) << graph.seconds / infer.seconds << 'x' << (sink == 0.123 ? " " : "") << std::endl;
+    record("inference", "infer " + shapeName(layers),
+      { { "ns_per_op", infer.seconds * 1e9 }, { "allocs_per_op", infer.allocations }, { "graph_ns_per_op", graph.seconds * 1e9 } });
+  }
+  // Layer sizes fixed at compile time
+  const auto mlp = MultilayerPerceptron({ 3, 4, 4, 1 });
+  const auto model = StaticMultilayerPerceptron<3, 4, 4, 1>(mlp);
+  MultilayerPerceptron::InferenceBuffers buffers;
+  std::array<double, 3> input{ 0.5, 0.5, 0.5 };
+  double sink = 0.0;
+  // Timed in batches, at tens of nanoseconds per sample reading the clock would dominate
+  constexpr size_t Samples = 1000;
+  const auto infer = measure([&]() {
+    for (size_t i=0; i<Samples; ++i) {
+      input[0] = sink * 1e-30;
+      sink += mlp.infer(input, buffers).front();
+    }
+  });
+  const auto fixed = measure([&]() {
+    for (size_t i=0; i<Samples; ++i) {
+      input[0] = sink * 1e-30;
+      sink += model(input)[0];
+    }
+  });
+  std::cout << std::setw(22) << "3-4-1 static" << std::setw(12) << "" << std::setw(12) << std::fixed << std::setprecision(3) << fixed.seconds / Samples * 1e6
+    << std::setw(9) << std::setprecision(2) << infer.seconds / fixed.seconds << 'x' << (sink == 0.123 ? " " : "") << " vs infer" << std::endl;
+  record("inference", "static 3-4-4-1",
+    { { "ns_per_op", fixed.seconds / Samples * 1e9 }, { "allocs_per_op", fixed.allocations / Samples }, { "infer_ns_per_op", infer.seconds / Samples * 1e9 } });
+}
+
+// Inference server throughput with 256 requests in flight, against answering them one by one
+void serverBench()
+{
+  std::cout << "Inference server, 256 concurrent requests (us/request)" << std::endl;
+  std::cout << std::setw(22) << "layers" << std::setw(12) << "infer" << std::setw(12) << "server" << std::setw(10) << "speedup" << std::endl;
+  const auto layers = std::vector<size_t>{ 64, 128, 128, 10 };
+  const auto mlp = MultilayerPerceptron(layers);
+  constexpr size_t Requests = 256;
+  const std::vector<double> input(layers.front(), 0.5);
+  double sink = 0.0;
+  MultilayerPerceptron::InferenceBuffers buffers;
+  const auto infer = measure([&]() {
+    for (size_t i=0; i<Requests; ++i) {
+      sink += mlp.infer(input, buffers).front();
+    }
+  });
+  InferenceServer server(mlp, { 64, std::chrono::microseconds(200) });
+  std::vector<std::future<std::vector<double>>> results(Requests);
+  const auto served = measure([&]() {
+    for (auto& r : results) {
+      r = server.submit(input);
+    }
+    for (auto& r : results) {
+      sink += r.get().front();
+    }
+  });
+  std::cout << std::setw(22) << shapeName(layers)
+    << std::setw(12) << std::fixed << std::setprecision(3) << infer.seconds / Requests * 1e6
+    << std::setw(12) << served.seconds / Requests * 1e6
+    << std::setw(9) << std::setprecision(2) << infer.seconds / served.seconds << 'x' << (sink == 0.123 ? " " : "") << std::endl;
+  record("server", "InferenceServer " + shapeName(layers),
+    { { "ns_per_op", served.seconds / Requests * 1e9 }, { "allocs_per_op", served.allocations / Requests }, { "infer_ns_per_op", infer.seconds / Requests * 1e9 } });
+}
+
+// One forward + backward training step: rebuilding the graph vs replaying a traced plan
+void compileBench()
+{
+  std::cout << "MLP training step, 16 samples (us/step)" << std::endl;
+  std::cout << std::setw(22) << "layers" << std::setw(12) << "graph" << std::setw(12) << "compiled" << std::setw(10) << "speedup" << std::endl;
+  const auto layers = std::vector<size_t>{ 8, 16, 16, 1 };
+  const auto mlp = MultilayerPerceptron(layers);
+  const auto params = mlp.parameters();
+  std::vector<std::vector<ValuePtr>> xs(16);
+  std::vector<ValuePtr> ys;
+  std::vector<ValuePtr> inputs;
+  for (auto& x : xs) {
+    for (size_t i=0; i<layers.front(); ++i) {
+      x.push_back(Value::make(double(rand() % 7) - 3.0));
+    }
+    inputs.insert(inputs.end(), x.begin(), x.end());
+    ys.push_back(Value::make(1.0));
+  }
+  auto lossOf = [&]() {
+    auto loss = Value::make(0.0);
+    for (size_t i=0; i<xs.size(); ++i) {
+      loss = loss + power(ys[i] - mlp(xs[i]).front(), 2.0);
+    }
+    return loss;
+  };
+  const auto graph = timeIt([&]() { lossOf()->backwards(); });
+  auto compiled = CompiledGraph::trace(lossOf(), inputs, params);
+  const auto replay = measure([&]() {
+    compiled.forward();
+    compiled.backwards();
+  });
+  std::cout << std::setw(22) << "8-16-16-1"
+    << std::setw(12) << std::fixed << std::setprecision(3) << graph * 1e6
+    << std::setw(12) << replay.seconds * 1e6
+    << std::setw(9) << std::setprecision(2) << graph / replay.seconds << 'x' << std::endl;
+  record("compile", "replay step 8-16-16-1",
+    { { "ns_per_op", replay.seconds * 1e9 }, { "allocs_per_op", replay.allocations }, { "graph_ns_per_op", graph * 1e9 } });
+}
+
+// Data parallel training throughput by number of threads (one shard per thread)
+void dataParallelBench()
+{
+  std::cout << "Data parallel MLP training, 64-256-256-10, batch 1024 (samples/s)" << std::endl;
+  std::cout << std::setw(22) << "threads" << std::setw(12) << "samples/s" << std::setw(10) << "scaling" << std::endl;
+  const auto inputs = Tensor::random({ 1024, 64 });
+  const auto targets = Tensor::random({ 1024, 10 });
+  double baseline = 0.0;
+  for (size_t threads : { 1, 2, 4, 8, 16, 32 }) {
+    ThreadPool::setGlobalThreadCount(threads);
+    auto model = TensorMultilayerPerceptron({ 64, 256, 256, 10 });
+    auto optimizer = SGD(0.001);
+    auto trainer = DataParallelTrainer(model, optimizer, threads);
+    const auto seconds = timeIt([&]() { trainer.step(inputs, targets); });
+    const auto throughput = double(inputs.shape()[0]) / seconds;
+    if (threads == 1) {
+      baseline = throughput;
+    }
+    std::cout << std::setw(22) << threads
+      << std::setw(12) << std::fixed << std::setprecision(0) << throughput
+      << std::setw(9) << std::setprecision(2) << throughput / baseline << 'x' << std::endl;
+    record("dataparallel", "DataParallelTrainer step " + std::to_string(threads) + " threads",
+      { { "ns_per_op", seconds * 1e9 }, { "samples_per_sec", throughput } });
+  }
+
+  // Many small models: Hogwild workers stepping on batches of 8 without synchronizing
+  std::cout << "Hogwild MLP training, 16-32-1, batch 8, 4096 samples (samples/s)" << std::endl;
+  std::cout << std::setw(22) << "threads" << std::setw(12) << "samples/s" << std::setw(10) << "scaling" << std::endl;
+  const auto smallInputs = Tensor::random({ 4096, 16 });
+  const auto smallTargets = Tensor::random({ 4096, 1 });
+  for (size_t threads : { 1, 2, 4, 8, 16, 32 }) {
+    ThreadPool::setGlobalThreadCount(threads);
+    auto model = TensorMultilayerPerceptron({ 16, 32, 1 });
+    auto trainer = HogwildTrainer(model, 0.001, threads, 8);
+    const auto seconds = timeIt([&]() { trainer.epoch(smallInputs, smallTargets); });
+    const auto throughput = double(smallInputs.shape()[0]) / seconds;
+    if (threads == 1) {
+      baseline = throughput;
+    }
+    std::cout << std::setw(22) << threads
+      << std::setw(12) << std::fixed << std::setprecision(0) << throughput
+      << std::setw(9) << std::setprecision(2) << throughput / baseline << 'x' << std::endl;
+    record("dataparallel", "HogwildTrainer epoch " + std::to_string(threads) + " threads",
+      { { "ns_per_op", seconds * 1e9 }, { "samples_per_sec", throughput } });
+  }
+  ThreadPool::setGlobalThreadCount(std::max<size_t>(1, std::thread::hardware_concurrency()));
+}
+
+// int8 GEMM against double, and a quantized model against its double precision original
+void quantizeBench()
+{
+  std::cout << "int8 (int32 accumulation) vs double gemm (GOP/s)" << std::endl;
+  std::cout << std::setw(22) << "m x n x k" << std::setw(12) << "double" << std::setw(12) << "int8" << std::setw(10) << "speedup" << std::endl;
+  for (size_t size : { 256, 1000 }) {
+    std::vector<double> a(size * size, 0.5);
+    std::vector<double> b(size * size, 0.25);
+    std::vector<double> c(size * size);
+    std::vector<int8_t> qa(size * size, 64);
+    std::vector<int8_t> qb(size * size, -32);
+    std::vector<int32_t> qc(size * size);
+    const auto flops = 2.0 * size * size * size;
+    const auto dense = timeIt([&]() { kernels::gemm(size, size, size, a.data(), size, b.data(), size, c.data(), size); });
+    const auto quantized = timeIt([&]() {
+      std::fill(qc.begin(), qc.end(), 0);
+      kernels::gemm<int8_t, int32_t>(size, size, size, qa.data(), size, qb.data(), size, qc.data(), size);
+    });
+    const auto shape = std::to_string(size) + " x " + std::to_string(size) + " x " + std::to_string(size);
+    std::cout << std::setw(22) << shape
+      << std::setw(12) << std::fixed << std::setprecision(2) << flops / dense / 1e9
+      << std::setw(12) << flops / quantized / 1e9
+      << std::setw(9) << dense / quantized << 'x' << std::endl;
+    record("quantize", "int8 gemm " + shape, { { "ns_per_op", quantized * 1e9 }, { "gops", flops / quantized / 1e9 }, { "double_gflops", flops / dense / 1e9 } });
+  }
+
+  std::cout << "Quantized TensorMultilayerPerceptron forward (us/batch)" << std::endl;
+  std::cout << std::setw(22) << "layers, batch" << std::setw(12) << "double" << std::setw(12) << "int8" << std::setw(10) << "speedup"
+    << std::setw(12) << "KiB" << std::setw(12) << "int8 KiB" << std::setw(12) << "max error" << std::endl;
+  for (const auto& layers : { std::vector<size_t>{ 64, 128, 128, 10 }, std::vector<size_t>{ 256, 1024, 1024, 10 } }) {
+    auto model = TensorMultilayerPerceptron(layers);
+    const auto quantized = QuantizedMultilayerPerceptron(model);
+    for (size_t batch : { 1, 256 }) {
+      const auto inputs = Tensor::random({ batch, layers.front() });
+      const auto dense = measure([&]() { auto y = model(inputs); });
+      const auto fast = measure([&]() { auto y = quantized(inputs); });
+      const auto report = quant::compare(model, quantized, inputs);
+      const auto name = shapeName(layers) + ", " + std::to_string(batch);
+      std::cout << std::setw(22) << name
+        << std::setw(12) << std::fixed << std::setprecision(2) << dense.seconds * 1e6
+        << std::setw(12) << fast.seconds * 1e6
+        << std::setw(9) << dense.seconds / fast.seconds << 'x'
+        << std::setw(12) << std::setprecision(0) << report.referenceBytes / 1024.0
+        << std::setw(12) << report.quantizedBytes / 1024.0
+        << std::setw(12) << std::setprecision(5) << report.maxAbsError / report.maxAbsOutput << std::endl;
+      record("quantize", "QuantizedMultilayerPerceptron " + shapeName(layers) + " batch " + std::to_string(batch),
+        { { "ns_per_op", fast.seconds * 1e9 }, { "double_ns_per_op", dense.seconds * 1e9 },
+          { "bytes", double(report.quantizedBytes) }, { "double_bytes", double(report.referenceBytes) },
+          { "max_abs_error", report.maxAbsError }, { "rms_error", report.rmsError } });
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  const auto suites = std::vector<std::pair<std::string, void (*)()>>{
+    { "matmul", matmulBench },
+    { "elementwise", elementwiseBench },
+    { "reduction", reductionBench },
+    { "graph", graphBench },
+    { "mlp", mlpBench },
+    { "inference", inferenceBench },
+    { "server", serverBench },
+    { "compile", compileBench },
+    { "dataparallel", dataParallelBench },
+    { "quantize", quantizeBench }
+  };
+  std::string jsonPath;
+  std::set<std::string> selected;
+  for (int i=1; i<argc; ++i) {
+    if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      jsonPath = argv[++i];
+    } else {
+      selected.insert(argv[i]);
+    }
+  }
+  for (const auto& name : selected) {
+    if (std::find_if(suites.begin(), suites.end(), [&](const auto& s) { return s.first == name; }) == suites.end()) {
+      std::cerr << "Unknown suite " << name << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  for (const auto& [name, run] : suites) {
+    if (selected.empty() || selected.contains(name)) {
+      run();
+    }
+  }
+  if (!jsonPath.empty()) {
+    std::ofstream out(jsonPath);
+    writeJson(out);
+    if (!out) {
+      std::cerr << "Cannot write " << jsonPath << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Global operator new/delete counting the process' heap allocations for the benchmarks
+// Kept out of bench.cpp: inlined into its call sites, GCC would otherwise pair the
+// malloc/free here with new/delete expressions there and warn (-Wmismatched-new-delete)
+std::atomic<size_t> allocationCount{0};
+
+void* operator new(size_t size)
+{
+  ++allocationCount;
+  if (auto p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void* operator new(size_t size, std::align_val_t alignment)
+{
+  ++allocationCount;
+  const auto align = size_t(alignment);
+  if (auto p = std::aligned_alloc(align, (size + align - 1) / align * align)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
\ No newline at end of file
@@ -0,0 +1,314 @@
+#pragma once
+
+#include "nn.hpp"
+#include "optimizer.hpp"
+#include "tensor.hpp"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Binary checkpoints of Tensor data and model parameters
+//
+// Layout (version 1, native byte order, recorded so mismatches are rejected):
+// - char[8] magic "VSGCKPT", uint32 version, uint32 byte order marker,
+//   uint32 element size (8: double), uint32 tensor count, uint64 data offset (bytes, 64 byte aligned)
+// - per tensor: uint32 rank, uint32 reserved, uint64 dims[rank], uint64 element offset into the data
+// - the elements of every tensor, row-major, back to back
+// The header is validated against the file size before any of it is trusted, so truncated or
+// corrupt files are rejected rather than read out of bounds.
+//
+// Loading memory maps the file and returns tensors viewing the mapping (copy-on-write, so
+// modifying them never writes back), so no parsing or copying of the data is needed: a model's
+// parameters are stored contiguously and become its ParameterBuffer as is.
+namespace checkpoint {
+
+constexpr char Magic[8] = { 'V', 'S', 'G', 'C', 'K', 'P', 'T', '\0' };
+constexpr uint32_t Version = 1;
+constexpr uint32_t ByteOrder = 0x01020304;
+constexpr uint64_t DataAlignment = 64;
+
+// Read/write private mapping of a whole file, unmapped once the last tensor viewing it is released
+class MappedFile {
+  void* _data = nullptr;
+  size_t _size = 0;
+
+  MappedFile(void* data, size_t size) : _data(data), _size(size)
+  {}
+public:
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile() {
+    if (_data) {
+      munmap(_data, _size);
+    }
+  }
+
+  static std::shared_ptr<MappedFile> open(const std::string& path) {
+    const auto fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Cannot open checkpoint " + path);
+    }
+    struct stat info {};
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+      ::close(fd);
+      throw std::runtime_error("Cannot read checkpoint " + path);
+    }
+    const auto size = size_t(info.st_size);
+    auto data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+      throw std::runtime_error("Cannot map checkpoint " + path);
+    }
+    return std::shared_ptr<MappedFile>(new MappedFile(data, size));
+  }
+
+  std::byte* data() const { return static_cast<std::byte*>(_data); }
+  size_t size() const { return _size; }
+};
+
+namespace detail {
+
+class Reader {
+  const std::byte* _data;
+  size_t _size;
+  size_t _position = 0;
+public:
+  Reader(const std::byte* data, size_t size) : _data(data), _size(size)
+  {}
+
+  template<typename T>
+  T read() {
+    if (_position + sizeof(T) > _size) {
+      throw std::runtime_error("Checkpoint is truncated");
+    }
+    T value;
+    std::memcpy(&value, _data + _position, sizeof(T));
+    _position += sizeof(T);
+    return value;
+  }
+  size_t position() const { return _position; }
+};
+
+template<typename T>
+void write(std::ofstream& out, T value) {
+  out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+}
+
+// Writes 'tensors' (of any layout, stored row-major) to 'path'
+void save(const std::string& path, const std::vector<Tensor>& tensors)
+{
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    throw std::runtime_error("Cannot create checkpoint " + path);
+  }
+  uint64_t headerSize = sizeof(Magic) + 4 * sizeof(uint32_t) + sizeof(uint64_t);
+  for (const auto& t : tensors) {
+    headerSize += 2 * sizeof(uint32_t) + (t.shape().size() + 1) * sizeof(uint64_t);
+  }
+  const auto dataOffset = (headerSize + DataAlignment - 1) / DataAlignment * DataAlignment;
+
+  out.write(Magic, sizeof(Magic));
+  detail::write<uint32_t>(out, Version);
+  detail::write<uint32_t>(out, ByteOrder);
+  detail::write<uint32_t>(out, sizeof(double));
+  detail::write<uint32_t>(out, uint32_t(tensors.size()));
+  detail::write<uint64_t>(out, dataOffset);
+  uint64_t elementOffset = 0;
+  for (const auto& t : tensors) {
+    detail::write<uint32_t>(out, uint32_t(t.shape().size()));
+    detail::write<uint32_t>(out, 0);
+    for (auto d : t.shape()) {
+      detail::write<uint64_t>(out, d);
+    }
+    detail::write<uint64_t>(out, elementOffset);
+    elementOffset += t.size();
+  }
+  const std::vector<char> padding(dataOffset - headerSize, 0);
+  out.write(padding.data(), padding.size());
+  for (const auto& t : tensors) {
+    const auto data = t.contiguous();
+    const auto elements = data.data();
+    out.write(reinterpret_cast<const char*>(elements.data()), elements.size_bytes());
+  }
+  if (!out) {
+    throw std::runtime_error("Cannot write checkpoint " + path);
+  }
+}
+
+// Tensors of a checkpoint, viewing its memory mapping
+struct Mapped {
+  std::vector<Tensor> tensors;
+  // Element offset of each tensor within 'data'
+  std::vector<size_t> offsets;
+  // All of the elements
+  std::shared_ptr<double[]> data;
+  size_t size = 0;
+};
+
+Mapped map(const std::string& path)
+{
+  const auto file = MappedFile::open(path);
+  detail::Reader reader(file->data(), file->size());
+  char magic[sizeof(Magic)];
+  for (auto& c : magic) {
+    c = reader.read<char>();
+  }
+  if (std::memcmp(magic, Magic, sizeof(Magic)) != 0) {
+    throw std::runtime_error("Not a checkpoint: " + path);
+  }
+  if (reader.read<uint32_t>() != Version) {
+    throw std::runtime_error("Unsupported checkpoint version");
+  }
+  if (reader.read<uint32_t>() != ByteOrder || reader.read<uint32_t>() != sizeof(double)) {
+    throw std::runtime_error("Checkpoint byte order or element type does not match");
+  }
+  const auto count = reader.read<uint32_t>();
+  const auto dataOffset = reader.read<uint64_t>();
+  if (dataOffset % DataAlignment != 0 || dataOffset > file->size()) {
+    throw std::runtime_error("Checkpoint data offset is invalid");
+  }
+  const auto elements = (file->size() - dataOffset) / sizeof(double);
+
+  Mapped result;
+  // The storage shares ownership of the mapping
+  result.data = std::shared_ptr<double[]>(file, reinterpret_cast<double*>(file->data() + dataOffset));
+  result.size = elements;
+  for (uint32_t i=0; i<count; ++i) {
+    const auto rank = reader.read<uint32_t>();
+    reader.read<uint32_t>();
+    // The dims and the offset are within the header, which ends where the data starts
+    if (reader.position() > dataOffset || size_t(rank) + 1 > (dataOffset - reader.position()) / sizeof(uint64_t)) {
+      throw std::runtime_error("Checkpoint header is corrupt");
+    }
+    std::vector<size_t> shape(rank);
+    size_t size = 1;
+    for (auto& d : shape) {
+      d = reader.read<uint64_t>();
+      if (d != 0 && size > elements / d) {
+        throw std::runtime_error("Checkpoint tensor exceeds the data");
+      }
+      size *= d;
+    }
+    const auto offset = reader.read<uint64_t>();
+    if (offset > elements - size) {
+      throw std::runtime_error("Checkpoint tensor exceeds the data");
+    }
+    result.tensors.push_back(Tensor::fromStorage(result.data, offset, std::move(shape)));
+    result.offsets.push_back(offset);
+  }
+  return result;
+}
+
+std::vector<Tensor> load(const std::string& path)
+{
+  return map(path).tensors;
+}
+
+// Tensor models: each layer as its [inputs, outputs] weights and [1, outputs] bias
+void save(const std::string& path, const TensorMultilayerPerceptron& model)
+{
+  const auto& layers = model.neuronsPerLayer();
+  const auto& buffer = model.parameterBuffer();
+  std::vector<Tensor> tensors;
+  size_t offset = 0;
+  for (size_t i=0; i+1<layers.size(); ++i) {
+    tensors.push_back(buffer.valueView(offset, { layers[i], layers[i+1] }));
+    offset += layers[i] * layers[i+1];
+    tensors.push_back(buffer.valueView(offset, { 1, layers[i+1] }));
+    offset += layers[i+1];
+  }
+  save(path, tensors);
+}
+
+// Zero-copy when the layers are stored back to back in order (as save() writes them): the model's
+// parameter buffer is then the mapped checkpoint data. Otherwise the layers are copied into a new buffer.
+TensorMultilayerPerceptron loadTensorMultilayerPerceptron(const std::string& path)
+{
+  auto mapped = map(path);
+  const auto& tensors = mapped.tensors;
+  if (tensors.empty() || tensors.size() % 2 != 0) {
+    throw std::runtime_error("Checkpoint does not hold a TensorMultilayerPerceptron");
+  }
+  std::vector<size_t> neuronsPerLayer{ tensors[0].shape().at(0) };
+  size_t expectedOffset = 0;
+  bool inOrder = true;
+  for (size_t i=0; i<tensors.size(); i+=2) {
+    const auto& weights = tensors[i].shape();
+    const auto& bias = tensors[i+1].shape();
+    if (weights.size() != 2 || weights[0] != neuronsPerLayer.back() || bias != std::vector<size_t>{ 1, weights[1] }) {
+      throw std::runtime_error("Checkpoint layer shapes do not match a TensorMultilayerPerceptron");
+    }
+    neuronsPerLayer.push_back(weights[1]);
+    inOrder = inOrder && mapped.offsets[i] == expectedOffset && mapped.offsets[i+1] == expectedOffset + tensors[i].size();
+    expectedOffset += tensors[i].size() + tensors[i+1].size();
+  }
+  if (inOrder) {
+    return TensorMultilayerPerceptron(neuronsPerLayer, ParameterBuffer(mapped.data, expectedOffset));
+  }
+  ParameterBuffer buffer(expectedOffset);
+  auto values = buffer.values().begin();
+  for (const auto& t : tensors) {
+    const auto data = t.data();
+    values = std::copy(data.begin(), data.end(), values);
+  }
+  return TensorMultilayerPerceptron(neuronsPerLayer, buffer);
+}
+
+// Scalar models: each layer as its [outputs, inputs] weights and [outputs] biases
+// Loading copies into the parameter nodes, whose values are not stored as a flat array
+template<typename V>
+void save(const std::string& path, const BasicMultilayerPerceptron<V>& model)
+{
+  auto values = [](std::span<const V> parameters) {
+    std::vector<double> result;
+    for (const auto& p : parameters) {
+      result.push_back(double(p->_value));
+    }
+    return result;
+  };
+  std::vector<Tensor> tensors;
+  for (const auto& l : model.layers()) {
+    tensors.push_back(Tensor(values(l.weights()), { l.numberOfOutputs(), l.numberOfInputs() }));
+    tensors.push_back(Tensor(values(l.biases()), { l.numberOfOutputs() }));
+  }
+  save(path, tensors);
+}
+
+template<typename V>
+void load(const std::string& path, BasicMultilayerPerceptron<V>& model)
+{
+  const auto tensors = load(path);
+  const auto& layers = model.layers();
+  if (tensors.size() != 2 * layers.size()) {
+    throw std::runtime_error("Checkpoint layer count does not match the model");
+  }
+  for (size_t i=0; i<layers.size(); ++i) {
+    const auto& weights = tensors[2 * i];
+    const auto& biases = tensors[2 * i + 1];
+    if (weights.shape() != std::vector<size_t>{ layers[i].numberOfOutputs(), layers[i].numberOfInputs() }
+      || biases.shape() != std::vector<size_t>{ layers[i].numberOfOutputs() }) {
+      throw std::runtime_error("Checkpoint layer shapes do not match the model");
+    }
+    auto assign = [](std::span<const V> parameters, const Tensor& values) {
+      const auto data = values.data();
+      for (size_t j=0; j<parameters.size(); ++j) {
+        parameters[j]->_value = data[j];
+      }
+    };
+    assign(layers[i].weights(), weights);
+    assign(layers[i].biases(), biases);
+  }
+}
+
+}
\ No newline at end of file
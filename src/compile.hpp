@@ -0,0 +1,292 @@
+#pragma once
+
+#include "engine.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+// Static execution plan traced from a Value graph (e.g. one forward + loss pass)
+// Tracing classifies every leaf of the graph as:
+// - a parameter: read from its node on each forward(), its gradient accumulated into the node
+// - an input: a slot set with setInput(...) before each forward()
+// - anything else is a constant
+// Subexpressions depending only on constants are folded (e.g. x - (2 * 3) becomes a single
+// 'add constant' step), identities (x + 0, x - 0, x * 1, x / 1, x ^ 1) are elided,
+// and steps not depending on any parameter (e.g. only transforming inputs) are skipped by backwards().
+//
+// Replaying then runs the steps linearly over flat value/gradient arrays:
+// no nodes are allocated and no topological sort is needed.
+template<typename T>
+class BasicCompiledGraph {
+  using Value = BasicValue<T>;
+  using ValuePtr = BasicValuePtr<T>;
+public:
+  enum class Instruction : uint8_t {
+    Add,
+    Multiply,
+    AddConstant,
+    MultiplyConstant,
+    Power,
+    RELU,
+    Subtract,
+    Divide,
+    MultiplyAdd,
+    SquaredError
+  };
+private:
+  struct Step {
+    Instruction instruction;
+    uint32_t result;
+    uint32_t lhs;
+    // Unused by the single operand instructions
+    uint32_t rhs;
+    // Addend of MultiplyAdd
+    uint32_t extra;
+    // Immediate operand of the constant instructions, exponent of Power
+    T constant;
+    bool requiresGrad;
+  };
+
+  // Slot layout: [parameters, inputs, intermediates]
+  std::vector<Step> _steps;
+  std::vector<T> _values;
+  std::vector<T> _grads;
+  std::vector<Value*> _parameters;
+  size_t _numberOfInputs = 0;
+  uint32_t _root = 0;
+
+  struct Entry {
+    bool constant;
+    T value;
+    uint32_t slot;
+    bool requiresGrad;
+  };
+
+  uint32_t addSlot(T value) {
+    _values.push_back(value);
+    return uint32_t(_values.size() - 1);
+  }
+  Entry emit(Instruction instruction, const Entry& lhs, const Entry* rhs, T constant, T value, const Entry* extra = nullptr) {
+    const auto requiresGrad = lhs.requiresGrad || (rhs && rhs->requiresGrad) || (extra && extra->requiresGrad);
+    const auto slot = addSlot(value);
+    _steps.push_back({ instruction, slot, lhs.slot, rhs ? rhs->slot : lhs.slot, extra ? extra->slot : lhs.slot, constant, requiresGrad });
+    return { false, value, slot, requiresGrad };
+  }
+  static Entry folded(T value) { return { true, value, 0, false }; }
+  // Places a folded constant into a slot of its own when an instruction needs it as an operand
+  Entry materialize(const Entry& entry) {
+    return entry.constant ? Entry{ false, entry.value, addSlot(entry.value), false } : entry;
+  }
+
+  Entry compile(const Value& node, const Entry& a, const Entry* b, const Entry* c) {
+    const auto value = node._value;
+    switch (node._inputs.operation) {
+      case Operation::Addition: {
+        if (a.constant && b->constant) {
+          return folded(a.value + b->value);
+        }
+        if (a.constant || b->constant) {
+          const auto& [c, x] = a.constant ? std::pair{ a, *b } : std::pair{ *b, a };
+          return c.value == T(0) ? x : emit(Instruction::AddConstant, x, nullptr, c.value, value);
+        }
+        return emit(Instruction::Add, a, b, T(0), value);
+      }
+      case Operation::Multiplication: {
+        if (a.constant && b->constant) {
+          return folded(a.value * b->value);
+        }
+        if (a.constant || b->constant) {
+          const auto& [c, x] = a.constant ? std::pair{ a, *b } : std::pair{ *b, a };
+          if (c.value == T(0)) {
+            return folded(T(0));
+          }
+          return c.value == T(1) ? x : emit(Instruction::MultiplyConstant, x, nullptr, c.value, value);
+        }
+        return emit(Instruction::Multiply, a, b, T(0), value);
+      }
+      case Operation::Power: {
+        const auto exponent = node._inputs.power;
+        if (a.constant) {
+          return folded(std::pow(a.value, exponent));
+        }
+        return exponent == T(1) ? a : emit(Instruction::Power, a, nullptr, exponent, value);
+      }
+      case Operation::RELU:
+        if (a.constant) {
+          return folded(a.value > T(0) ? a.value : T(0));
+        }
+        return emit(Instruction::RELU, a, nullptr, T(0), value);
+      case Operation::Subtraction: {
+        if (a.constant && b->constant) {
+          return folded(a.value - b->value);
+        }
+        if (b->constant) {
+          return b->value == T(0) ? a : emit(Instruction::AddConstant, a, nullptr, -b->value, value);
+        }
+        const auto lhs = materialize(a);
+        return emit(Instruction::Subtract, lhs, b, T(0), value);
+      }
+      case Operation::Division: {
+        if (a.constant && b->constant) {
+          return folded(a.value / b->value);
+        }
+        if (b->constant) {
+          return b->value == T(1) ? a : emit(Instruction::MultiplyConstant, a, nullptr, T(1) / b->value, value);
+        }
+        const auto lhs = materialize(a);
+        return emit(Instruction::Divide, lhs, b, T(0), value);
+      }
+      case Operation::MultiplyAdd: {
+        if (a.constant && b->constant && c->constant) {
+          return folded(a.value * b->value + c->value);
+        }
+        const auto lhs = materialize(a);
+        const auto rhs = materialize(*b);
+        const auto addend = materialize(*c);
+        return emit(Instruction::MultiplyAdd, lhs, &rhs, T(0), value, &addend);
+      }
+      case Operation::SquaredError: {
+        if (a.constant && b->constant) {
+          return folded((a.value - b->value) * (a.value - b->value));
+        }
+        const auto lhs = materialize(a);
+        const auto rhs = materialize(*b);
+        return emit(Instruction::SquaredError, lhs, &rhs, T(0), value);
+      }
+      case Operation::Null:
+        break;
+    }
+    throw std::runtime_error("Unhandled op");
+  }
+public:
+  static BasicCompiledGraph trace(const ValuePtr& root, std::span<const ValuePtr> inputs, std::span<const ValuePtr> parameters)
+  {
+    BasicCompiledGraph graph;
+    std::unordered_map<const Value*, Entry> entries;
+    for (auto& p : parameters) {
+      graph._parameters.push_back(p.get());
+      entries[p.get()] = { false, p->_value, graph.addSlot(p->_value), true };
+    }
+    graph._numberOfInputs = inputs.size();
+    for (auto& input : inputs) {
+      entries[input.get()] = { false, input->_value, graph.addSlot(input->_value), false };
+    }
+
+    std::vector<Value*> topo;
+    Value::buildTopo(topo, root.get());
+    for (auto node : topo) {
+      if (entries.contains(node)) {
+        continue;
+      }
+      const auto& slots = node->_inputs.values;
+      if (slots.size() == 0) {
+        entries[node] = folded(node->_value);
+        continue;
+      }
+      const auto a = entries.at(slots[0].get());
+      const auto b = slots.size() > 1 ? entries.at(slots[1].get()) : a;
+      const auto c = slots.size() > 2 ? entries.at(slots[2].get()) : a;
+      entries[node] = graph.compile(*node, a, slots.size() > 1 ? &b : nullptr, slots.size() > 2 ? &c : nullptr);
+    }
+
+    const auto& result = entries.at(root.get());
+    graph._root = result.constant ? graph.addSlot(result.value) : result.slot;
+    graph._grads.assign(graph._values.size(), T(0));
+    return graph;
+  }
+
+  // Number of steps executed by forward()
+  size_t size() const { return _steps.size(); }
+
+  size_t numberOfInputs() const { return _numberOfInputs; }
+  void setInput(size_t i, T value) { _values[_parameters.size() + i] = value; }
+  T value() const { return _values[_root]; }
+
+  // Evaluates the plan with the current parameter values and inputs, returning the result
+  T forward() {
+    for (size_t i=0; i<_parameters.size(); ++i) {
+      _values[i] = _parameters[i]->_value;
+    }
+    for (const auto& step : _steps) {
+      const auto a = _values[step.lhs];
+      const auto b = _values[step.rhs];
+      auto& result = _values[step.result];
+      switch (step.instruction) {
+        case Instruction::Add: result = a + b; break;
+        case Instruction::Multiply: result = a * b; break;
+        case Instruction::AddConstant: result = a + step.constant; break;
+        case Instruction::MultiplyConstant: result = a * step.constant; break;
+        case Instruction::Power: result = std::pow(a, step.constant); break;
+        case Instruction::RELU: result = a > T(0) ? a : T(0); break;
+        case Instruction::Subtract: result = a - b; break;
+        case Instruction::Divide: result = a / b; break;
+        case Instruction::MultiplyAdd: result = a * b + _values[step.extra]; break;
+        case Instruction::SquaredError: result = (a - b) * (a - b); break;
+      }
+    }
+    return _values[_root];
+  }
+
+  // Backpropagates the last forward(), accumulating into the parameter nodes' gradients
+  void backwards() {
+    std::fill(_grads.begin(), _grads.end(), T(0));
+    _grads[_root] = T(1);
+    for (auto it = _steps.rbegin(); it != _steps.rend(); ++it) {
+      const auto& step = *it;
+      if (!step.requiresGrad) {
+        continue;
+      }
+      const auto grad = _grads[step.result];
+      switch (step.instruction) {
+        case Instruction::Add:
+          _grads[step.lhs] += grad;
+          _grads[step.rhs] += grad;
+          break;
+        case Instruction::Multiply:
+          _grads[step.lhs] += _values[step.rhs] * grad;
+          _grads[step.rhs] += _values[step.lhs] * grad;
+          break;
+        case Instruction::AddConstant:
+          _grads[step.lhs] += grad;
+          break;
+        case Instruction::MultiplyConstant:
+          _grads[step.lhs] += step.constant * grad;
+          break;
+        case Instruction::Power:
+          _grads[step.lhs] += (step.constant * std::pow(_values[step.lhs], step.constant-1)) * grad;
+          break;
+        case Instruction::RELU:
+          _grads[step.lhs] += T(_values[step.result] > T(0)) * grad;
+          break;
+        case Instruction::Subtract:
+          _grads[step.lhs] += grad;
+          _grads[step.rhs] -= grad;
+          break;
+        case Instruction::Divide:
+          _grads[step.lhs] += grad / _values[step.rhs];
+          _grads[step.rhs] -= grad * _values[step.result] / _values[step.rhs];
+          break;
+        case Instruction::MultiplyAdd:
+          _grads[step.lhs] += _values[step.rhs] * grad;
+          _grads[step.rhs] += _values[step.lhs] * grad;
+          _grads[step.extra] += grad;
+          break;
+        case Instruction::SquaredError: {
+          const auto delta = T(2) * (_values[step.lhs] - _values[step.rhs]) * grad;
+          _grads[step.lhs] += delta;
+          _grads[step.rhs] -= delta;
+          break;
+        }
+      }
+    }
+    for (size_t i=0; i<_parameters.size(); ++i) {
+      _parameters[i]->_grad += _grads[i];
+    }
+  }
+};
+
+using CompiledGraph = BasicCompiledGraph<double>;
\ No newline at end of file
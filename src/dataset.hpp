@@ -0,0 +1,325 @@
+#pragma once
+
+#include "tensor.hpp"
+#include <charconv>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Streaming of training samples from disk into [batch, features] / [batch, targets] tensors
+//
+// A record is one sample: its features followed by its targets. Readers produce records
+// sequentially, so a dataset never has to fit in memory:
+// - CsvReader: one record per line of comma separated numbers
+// - BinaryReader: records of native doubles back to back (see writeBinary)
+// A DataLoader reads, shuffles and batches records on a background thread, prefetching
+// a few batches ahead so I/O and parsing overlap with training.
+
+// Records from a CSV file, optionally skipping a header line
+class CsvReader {
+  std::string _path;
+  size_t _width;
+  bool _header;
+  std::ifstream _in;
+  std::string _line;
+  size_t _lineNumber = 0;
+public:
+  CsvReader(std::string path, size_t width, bool header = false)
+  : _path(std::move(path)), _width(width), _header(header)
+  {
+    rewind();
+  }
+
+  size_t width() const { return _width; }
+
+  void rewind() {
+    _in = std::ifstream(_path);
+    if (!_in) {
+      throw std::runtime_error("Cannot open dataset " + _path);
+    }
+    _lineNumber = 0;
+    if (_header) {
+      std::getline(_in, _line);
+      ++_lineNumber;
+    }
+  }
+
+  // Reads the next record into 'record' (of width() elements), false at the end of the file
+  bool read(std::span<double> record) {
+    while (std::getline(_in, _line)) {
+      ++_lineNumber;
+      if (_line.find_first_not_of(" \t\r") == std::string::npos) {
+        continue;
+      }
+      const char* position = _line.data();
+      const char* end = _line.data() + _line.size();
+      for (size_t i=0; i<_width; ++i) {
+        while (position < end && (*position == ' ' || *position == '\t')) {
+          ++position;
+        }
+        const auto [next, error] = std::from_chars(position, end, record[i]);
+        if (error != std::errc()) {
+          throw std::runtime_error("Invalid number on line " + std::to_string(_lineNumber) + " of " + _path);
+        }
+        position = next;
+        while (position < end && (*position == ' ' || *position == '\t' || *position == '\r')) {
+          ++position;
+        }
+        if (i + 1 < _width) {
+          if (position == end || *position != ',') {
+            throw std::runtime_error("Expected " + std::to_string(_width) + " columns on line " + std::to_string(_lineNumber) + " of " + _path);
+          }
+          ++position;
+        }
+      }
+      if (position != end) {
+        throw std::runtime_error("Expected " + std::to_string(_width) + " columns on line " + std::to_string(_lineNumber) + " of " + _path);
+      }
+      return true;
+    }
+    return false;
+  }
+};
+
+// Records stored as raw native doubles, without any header
+class BinaryReader {
+  std::string _path;
+  size_t _width;
+  std::ifstream _in;
+public:
+  BinaryReader(std::string path, size_t width)
+  : _path(std::move(path)), _width(width), _in(_path, std::ios::binary)
+  {
+    if (!_in) {
+      throw std::runtime_error("Cannot open dataset " + _path);
+    }
+  }
+
+  size_t width() const { return _width; }
+
+  void rewind() {
+    _in.clear();
+    _in.seekg(0);
+  }
+
+  bool read(std::span<double> record) {
+    _in.read(reinterpret_cast<char*>(record.data()), std::streamsize(record.size_bytes()));
+    if (_in.gcount() == 0) {
+      return false;
+    }
+    if (size_t(_in.gcount()) != record.size_bytes()) {
+      throw std::runtime_error("Dataset " + _path + " ends with a partial record");
+    }
+    return true;
+  }
+};
+
+// Writes the rows of [samples, features] inputs and [samples, targets] targets as binary records
+void writeBinary(const std::string& path, const Tensor& inputs, const Tensor& targets)
+{
+  if (inputs.shape().size() != 2 || targets.shape().size() != 2 || inputs.shape()[0] != targets.shape()[0]) {
+    throw std::runtime_error("Inputs and targets must be matrices with the same number of rows");
+  }
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  const auto x = inputs.contiguous();
+  const auto y = targets.contiguous();
+  const auto features = inputs.shape()[1];
+  const auto outputs = targets.shape()[1];
+  for (size_t row=0; row<inputs.shape()[0]; ++row) {
+    out.write(reinterpret_cast<const char*>(x.data().data() + row * features), std::streamsize(features * sizeof(double)));
+    out.write(reinterpret_cast<const char*>(y.data().data() + row * outputs), std::streamsize(outputs * sizeof(double)));
+  }
+  if (!out) {
+    throw std::runtime_error("Cannot write dataset " + path);
+  }
+}
+
+struct Batch {
+  // [rows, features] and [rows, targets], rows being less than the batch size only for the last batch of an epoch
+  Tensor inputs;
+  Tensor targets;
+};
+
+struct DataLoaderOptions {
+  size_t batchSize = 32;
+  // Records are shuffled within a window of this many (1: read order)
+  size_t shuffleBuffer = 1;
+  // Batches prepared ahead of the consumer
+  size_t prefetch = 2;
+  // 0: seeded randomly
+  unsigned seed = 0;
+};
+
+// Background reader producing batches into a fixed set of reusable buffers
+// The Batch returned by next() views one of them, so it stays valid until the following call.
+// Every epoch rewinds the reader; an epoch ends with next() returning no batch once.
+template<typename Reader>
+class DataLoader {
+  struct Slot {
+    std::shared_ptr<double[]> inputs;
+    std::shared_ptr<double[]> targets;
+    size_t rows = 0;
+    // End of epoch marker rather than a batch
+    bool end = false;
+  };
+
+  Reader _reader;
+  size_t _features;
+  size_t _targets;
+  DataLoaderOptions _options;
+  std::vector<Slot> _slots;
+  std::deque<size_t> _free;
+  std::deque<size_t> _ready;
+  // Slot last handed out, returned to the free list by the next call
+  std::ptrdiff_t _current = -1;
+  std::exception_ptr _error;
+  bool _stop = false;
+  std::mutex _mutex;
+  std::condition_variable _changed;
+  std::thread _thread;
+
+  size_t acquire() {
+    std::unique_lock lock(_mutex);
+    _changed.wait(lock, [&]() { return _stop || !_free.empty(); });
+    if (_stop) {
+      return _slots.size();
+    }
+    const auto slot = _free.front();
+    _free.pop_front();
+    return slot;
+  }
+  void publish(size_t slot) {
+    {
+      std::lock_guard lock(_mutex);
+      _ready.push_back(slot);
+    }
+    _changed.notify_all();
+  }
+
+  void produce() {
+    const auto width = _features + _targets;
+    const auto window = std::max<size_t>(_options.shuffleBuffer, 1);
+    std::vector<double> buffer(window * width);
+    std::mt19937 twister(_options.seed ? _options.seed : std::random_device{}());
+    try {
+      while (true) {
+        // Fill the shuffle window, then emit a random record of it and refill its place
+        size_t buffered = 0;
+        while (buffered < window && _reader.read({ buffer.data() + buffered * width, width })) {
+          ++buffered;
+        }
+        auto slot = _slots.size();
+        auto take = [&](double* record) {
+          if (slot == _slots.size()) {
+            slot = acquire();
+            if (slot == _slots.size()) {
+              return false;
+            }
+            _slots[slot].rows = 0;
+            _slots[slot].end = false;
+          }
+          auto& s = _slots[slot];
+          std::copy_n(record, _features, s.inputs.get() + s.rows * _features);
+          std::copy_n(record + _features, _targets, s.targets.get() + s.rows * _targets);
+          if (++s.rows == _options.batchSize) {
+            publish(slot);
+            slot = _slots.size();
+          }
+          return true;
+        };
+        while (buffered > 0) {
+          const auto pick = window > 1 ? std::uniform_int_distribution<size_t>(0, buffered - 1)(twister) : 0;
+          const auto record = buffer.data() + pick * width;
+          if (!take(record)) {
+            return;
+          }
+          if (!_reader.read({ record, width })) {
+            std::copy_n(buffer.data() + (buffered - 1) * width, width, record);
+            --buffered;
+          }
+        }
+        if (slot != _slots.size()) {
+          publish(slot);
+        }
+        slot = acquire();
+        if (slot == _slots.size()) {
+          return;
+        }
+        _slots[slot].end = true;
+        publish(slot);
+        _reader.rewind();
+      }
+    } catch (...) {
+      {
+        std::lock_guard lock(_mutex);
+        _error = std::current_exception();
+      }
+      _changed.notify_all();
+    }
+  }
+public:
+  DataLoader(Reader reader, size_t features, size_t targets, DataLoaderOptions options = {})
+  : _reader(std::move(reader)), _features(features), _targets(targets), _options(options)
+  {
+    if (_reader.width() != features + targets) {
+      throw std::runtime_error("Reader record width does not match features + targets");
+    }
+    if (_options.batchSize == 0) {
+      throw std::runtime_error("Batch size must be positive");
+    }
+    // One more slot than prefetched: the one the consumer is using
+    _slots.resize(std::max<size_t>(_options.prefetch, 1) + 1);
+    for (size_t i=0; i<_slots.size(); ++i) {
+      _slots[i].inputs = std::make_shared<double[]>(_options.batchSize * features);
+      _slots[i].targets = std::make_shared<double[]>(_options.batchSize * targets);
+      _free.push_back(i);
+    }
+    _thread = std::thread([this]() { produce(); });
+  }
+  DataLoader(const DataLoader&) = delete;
+  DataLoader& operator=(const DataLoader&) = delete;
+  ~DataLoader() {
+    {
+      std::lock_guard lock(_mutex);
+      _stop = true;
+    }
+    _changed.notify_all();
+    _thread.join();
+  }
+
+  size_t batchSize() const { return _options.batchSize; }
+
+  // Waits for the next batch, none (once) at the end of each epoch
+  // Rethrows any error reading the dataset
+  std::optional<Batch> next() {
+    std::unique_lock lock(_mutex);
+    if (_current >= 0) {
+      _free.push_back(size_t(_current));
+      _current = -1;
+      _changed.notify_all();
+    }
+    _changed.wait(lock, [&]() { return !_ready.empty() || _error; });
+    if (_ready.empty()) {
+      std::rethrow_exception(_error);
+    }
+    const auto slot = _ready.front();
+    _ready.pop_front();
+    _current = std::ptrdiff_t(slot);
+    const auto& s = _slots[slot];
+    if (s.end) {
+      return std::nullopt;
+    }
+    return Batch{ Tensor::fromStorage(s.inputs, 0, { s.rows, _features }), Tensor::fromStorage(s.targets, 0, { s.rows, _targets }) };
+  }
+};
\ No newline at end of file
@@ -1,21 +1,38 @@
 #pragma once
 
 #include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
 #include <ostream>
 #include <algorithm>
 #include <iostream>
 #include <sstream>
-#include <unordered_set>
 #include <vector>
 #include <cmath>
 #include <memory>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+
+#include "profiler.hpp"
+#include "thread_pool.hpp"
 
 enum class Operation {
   Null,
   Addition,
   Multiplication,
   Power,
-  RELU
+  RELU,
+  // Fused operations, each being a single node in place of 2-3 elementary ones
+  Subtraction,
+  Division,
+  // a * b + c
+  MultiplyAdd,
+  // (a - b) ^ 2
+  SquaredError
 };
 
 std::string_view toString(Operation op)
@@ -27,23 +44,63 @@ std::string_view toString(Operation op)
     case Operation::Multiplication: return "*";
     case Operation::Power: return "pow";
     case Operation::RELU: return "RELU";
+    case Operation::Subtraction: return "-";
+    case Operation::Division: return "/";
+    case Operation::MultiplyAdd: return "*+";
+    case Operation::SquaredError: return "sqerr";
   }
 
   throw std::runtime_error("Unhandled op");
 }
 
-struct Value;
+template<typename T>
+struct BasicValue;
+
+template<typename T>
+using BasicValuePtr = std::shared_ptr<BasicValue<T>>;
+
+// Fixed capacity list of the input terms of an operation
+// Stored inline within the node so creating a node does not
+// require a separate heap allocation for its inputs
+template<typename T>
+struct BasicInputSlots {
+  // Enough for the three terms of MultiplyAdd
+  static constexpr size_t Capacity = 3;
+
+  std::array<BasicValuePtr<T>, Capacity> _slots;
+  size_t _size = 0;
+
+  BasicInputSlots() = default;
+  BasicInputSlots(std::initializer_list<BasicValuePtr<T>> values) {
+    for (const auto& v : values) {
+      push_back(v);
+    }
+  }
+
+  void push_back(BasicValuePtr<T> value) {
+    if (_size == Capacity) {
+      throw std::runtime_error("Too many inputs for operation");
+    }
+    _slots[_size++] = std::move(value);
+  }
+  size_t size() const { return _size; }
+  auto& operator[](size_t i) { return _slots[i]; }
+  const auto& operator[](size_t i) const { return _slots[i]; }
+  auto begin() const { return _slots.begin(); }
+  auto end() const { return _slots.begin() + _size; }
+};
 
-struct Inputs {
+template<typename T>
+struct BasicInputs {
   Operation operation = Operation::Null;
-  std::vector<std::shared_ptr<Value>> values;
-  double power = 0.0;
+  BasicInputSlots<T> values;
+  T power = 0;
 };
 
 // Note: do not construct directly unless you have specific requirements
 // Use the Value::make(...), as the ValuePtr type has all the operators defined on it
 //
-// Scalar floating point number type which allows building and evaluating
+// Scalar floating point number type (T being float or double) which allows building and evaluating
 // mathematical expression trees forwards and backward:
 // - Forwards: resolve/simplify the mathematical expression value
 // - Backwards: calculate the partial derivative for all input terms in the tree
@@ -51,62 +108,253 @@ struct Inputs {
 //
 // This is done by saving the input expressions/terms for each 'Value'
 // and traversing the tree as needed.
-struct Value {
-  double _value;
-  Inputs _inputs;
-  double _grad = 0.0;
-
-  static void buildTopo(
-    std::vector<Value*>& topo,
-    std::unordered_set<Value*>& visited,
-    Value* value)
+template<typename T>
+struct BasicValue {
+  T _value;
+  BasicInputs<T> _inputs;
+  T _grad = 0;
+
+  // Epoch of the last topological sort which reached this node
+  uint64_t _visitEpoch = 0;
+
+  static std::atomic<uint64_t>& visitEpochs() {
+    static std::atomic<uint64_t> epoch{0};
+    return epoch;
+  }
+  static uint64_t nextVisitEpoch() {
+    return ++visitEpochs();
+  }
+  // Reserves 'count' consecutive epochs, returning the first
+  // Used to number the nodes of a sorted graph without disturbing later traversals
+  static uint64_t reserveVisitEpochs(size_t count) {
+    return visitEpochs().fetch_add(count) + 1;
+  }
+
+  // Appends all nodes reachable from 'root' in topological order (inputs before their results)
+  // Iterative depth-first traversal, marking visited nodes with a fresh epoch
+  // rather than hashing them into a set, so deep graphs cannot exhaust the stack
+  static void buildTopo(std::vector<BasicValue*>& topo, BasicValue* root)
   {
-    if (visited.find(value) != visited.end()) {
-      return;
+    profiler::Scope scope(profiler::Phase::TopoSort);
+    thread_local std::vector<std::pair<BasicValue*, size_t>> stack;
+    const auto epoch = nextVisitEpoch();
+    root->_visitEpoch = epoch;
+    stack.push_back({ root, 0 });
+    while (!stack.empty()) {
+      auto& [value, next] = stack.back();
+      if (next < value->_inputs.values.size()) {
+        auto input = value->_inputs.values[next++].get();
+        if (input->_visitEpoch != epoch) {
+          input->_visitEpoch = epoch;
+          stack.push_back({ input, 0 });
+        }
+      } else {
+        topo.push_back(value);
+        stack.pop_back();
+      }
     }
+  }
 
-    visited.insert(value);
-    for (auto next : value->_inputs.values) {
-      buildTopo(topo, visited, next.get());
-    }
-    topo.push_back(value);
+  BasicValue(T value, BasicInputs<T> inputs = BasicInputs<T>{})
+  : _value(value), _inputs(std::move(inputs))
+  {
+    profiler::countNode(size_t(_inputs.operation), sizeof(BasicValue));
   }
+  BasicValue(const BasicValue&) = default;
+  BasicValue(BasicValue&&) = default;
+  BasicValue& operator=(const BasicValue&) = default;
+  BasicValue& operator=(BasicValue&&) = default;
 
-  Value(double value, Inputs inputs = Inputs{})
-  : _value(value), _inputs(inputs)
-  {}
+  // Releasing the last handle to the root of a long chain would otherwise destroy the chain
+  // recursively (each node's inputs releasing theirs), overflowing the stack for deep graphs.
+  // Instead, all inputs are moved onto a per-thread list, drained in a loop by the outermost
+  // destructor: every reference, including the last one to a node used several times
+  // (e.g. both inputs of v + v), is released from within the loop, never by a member
+  // destructor, so tearing down a graph of any depth uses constant stack
+  ~BasicValue() {
+    thread_local std::vector<BasicValuePtr<T>> pending;
+    thread_local bool draining = false;
+    for (size_t i=0; i<_inputs.values.size(); ++i) {
+      pending.push_back(std::move(_inputs.values[i]));
+    }
+    if (draining) {
+      return;
+    }
+    draining = true;
+    while (!pending.empty()) {
+      auto next = std::move(pending.back());
+      pending.pop_back();
+    }
+    draining = false;
+  }
 
   void zeroGrad() {
-    _grad = 0.0;
+    _grad = 0;
   }
 
-  void backwardsOnce() {
+  // Calls accumulate(i, d) with the gradient contribution 'd' of this node to its i-th input
+  template<typename Accumulate>
+  void propagate(Accumulate&& accumulate) const {
+    const auto& values = _inputs.values;
     if (_inputs.operation == Operation::Addition) {
-      _inputs.values[0]->_grad += _grad;
-      _inputs.values[1]->_grad += _grad;
+      accumulate(0, _grad);
+      accumulate(1, _grad);
     } else if (_inputs.operation == Operation::Multiplication) {
-      auto& a = _inputs.values[0];
-      auto& b = _inputs.values[1];
-      a->_grad += b->_value * _grad;
-      b->_grad += a->_value * _grad;
+      accumulate(0, values[1]->_value * _grad);
+      accumulate(1, values[0]->_value * _grad);
     } else if (_inputs.operation == Operation::Power) {
-      _inputs.values[0]->_grad += (_inputs.power * std::pow(_inputs.values[0]->_value, _inputs.power-1)) * _grad;
+      accumulate(0, (_inputs.power * std::pow(values[0]->_value, _inputs.power-1)) * _grad);
     } else if (_inputs.operation == Operation::RELU) {
-      _inputs.values[0]->_grad += double(_value > 0.0) * _grad;
+      accumulate(0, T(_value > T(0)) * _grad);
+    } else if (_inputs.operation == Operation::Subtraction) {
+      accumulate(0, _grad);
+      accumulate(1, -_grad);
+    } else if (_inputs.operation == Operation::Division) {
+      // d(a/b)/da = 1/b, d(a/b)/db = -a/b^2 = -(a/b)/b
+      accumulate(0, _grad / values[1]->_value);
+      accumulate(1, -(_grad * _value / values[1]->_value));
+    } else if (_inputs.operation == Operation::MultiplyAdd) {
+      accumulate(0, values[1]->_value * _grad);
+      accumulate(1, values[0]->_value * _grad);
+      accumulate(2, _grad);
+    } else if (_inputs.operation == Operation::SquaredError) {
+      const auto delta = T(2) * (values[0]->_value - values[1]->_value) * _grad;
+      accumulate(0, delta);
+      accumulate(1, -delta);
     }
   }
 
+  void backwardsOnce() {
+    propagate([this](size_t i, T d) { _inputs.values[i]->_grad += d; });
+  }
+
   void backwards()
   {
-    std::vector<Value*> topo;
-    std::unordered_set<Value*> visited;
-    buildTopo(topo, visited, this);
-    _grad = 1.0;
-    std::for_each(std::rbegin(topo), std::rend(topo), [&](Value* value) {
+    thread_local std::vector<BasicValue*> topo;
+    topo.clear();
+    buildTopo(topo, this);
+    backwards(topo);
+  }
+
+  // Backpropagates using a previously computed topological order of this node's graph
+  // The order stays valid across iterations as long as the same node addresses are reused
+  // with an unchanged structure, e.g. rebuilding the same model/batch shape in a reset GraphArena
+  void backwards(const std::vector<BasicValue*>& topo)
+  {
+    profiler::Scope scope(profiler::Phase::Backward);
+    _grad = 1;
+    std::for_each(std::rbegin(topo), std::rend(topo), [&](BasicValue* value) {
       value->backwardsOnce();
     });
   }
 
+  // Same result as backwards(), with the nodes of each level (being equally far from this node)
+  // processed in parallel. The nodes within a level never feed each other, and instead of
+  // contended updates of shared inputs (e.g. parameters used by every sample of a batch)
+  // each thread accumulates the gradients of the next level into its own array (indexed by
+  // position within that level), which the inputs sum when their level is reached.
+  // Memory is thus O(threads x widest level); inputs further down (skipping levels) are rare
+  // and updated atomically instead.
+  void backwardsParallel(ThreadPool& pool = ThreadPool::global())
+  {
+    constexpr size_t Grain = 256;
+    std::vector<BasicValue*> topo;
+    buildTopo(topo, this);
+    profiler::Scope scope(profiler::Phase::Backward);
+    const auto n = topo.size();
+    const auto base = reserveVisitEpochs(n);
+    for (size_t i=0; i<n; ++i) {
+      topo[i]->_visitEpoch = base + i;
+    }
+    const auto indexOf = [base](const BasicValue* value) { return size_t(value->_visitEpoch - base); };
+
+    // Level of a node: longest path from this node, so all of its consumers are at lower levels
+    std::vector<uint32_t> levels(n, 0);
+    uint32_t deepest = 0;
+    for (size_t i=n; i-- > 0;) {
+      for (const auto& input : topo[i]->_inputs.values) {
+        auto& level = levels[indexOf(input.get())];
+        level = std::max(level, levels[i] + 1);
+        deepest = std::max(deepest, level);
+      }
+    }
+    std::vector<size_t> levelStart(deepest + 2, 0);
+    for (auto level : levels) {
+      ++levelStart[level + 1];
+    }
+    size_t widest = 0;
+    for (size_t l=1; l<levelStart.size(); ++l) {
+      widest = std::max(widest, levelStart[l]);
+      levelStart[l] += levelStart[l - 1];
+    }
+    std::vector<BasicValue*> order(n);
+    // Position of each node (by topo index) within its level
+    std::vector<uint32_t> position(n);
+    auto next = levelStart;
+    for (size_t i=0; i<n; ++i) {
+      position[i] = uint32_t(next[levels[i]] - levelStart[levels[i]]);
+      order[next[levels[i]]++] = topo[i];
+    }
+
+    // Double buffered per thread: gradients flowing into the level being processed, and out
+    // of it into the next one. A thread clears its outgoing array when it first writes to it,
+    // and only the arrays written to are summed.
+    const auto threads = pool.size();
+    std::array<std::vector<std::vector<T>>, 2> partials;
+    std::array<std::vector<char>, 2> used;
+    for (size_t b=0; b<2; ++b) {
+      partials[b].assign(threads, std::vector<T>(widest, T(0)));
+      used[b].assign(threads, 0);
+    }
+    std::vector<size_t> sources;
+    uint32_t current = 0;
+    auto process = [&](size_t begin, size_t end) {
+      const auto me = pool.threadIndex();
+      const auto out = (current + 1) % 2;
+      auto& mine = partials[out][me];
+      const auto nextWidth = levelStart[std::min<size_t>(current + 2, deepest + 1)] - levelStart[current + 1];
+      for (auto k=begin; k<end; ++k) {
+        auto node = order[k];
+        const auto i = indexOf(node);
+        T grad = 0;
+        for (auto t : sources) {
+          grad += partials[current % 2][t][position[i]];
+        }
+        node->_grad += grad;
+        node->propagate([&](size_t input, T d) {
+          const auto target = node->_inputs.values[input].get();
+          const auto j = indexOf(target);
+          if (levels[j] == current + 1) {
+            if (!used[out][me]) {
+              std::fill_n(mine.begin(), nextWidth, T(0));
+              used[out][me] = 1;
+            }
+            mine[position[j]] += d;
+          } else {
+            std::atomic_ref(target->_grad).fetch_add(d, std::memory_order_relaxed);
+          }
+        });
+      }
+    };
+    _grad = 1;
+    for (; current<=deepest; ++current) {
+      const auto begin = levelStart[current];
+      const auto end = levelStart[current + 1];
+      sources.clear();
+      for (size_t t=0; t<threads; ++t) {
+        if (used[current % 2][t]) {
+          sources.push_back(t);
+        }
+      }
+      std::fill(used[(current + 1) % 2].begin(), used[(current + 1) % 2].end(), 0);
+      if (end - begin < 2 * Grain) {
+        process(begin, end);
+      } else {
+        pool.parallelFor(begin, end, Grain, process);
+      }
+    }
+  }
+
   void printTree(int indents = 0)
   {
     std::string_view operation = _inputs.operation != Operation::Null ? toString(_inputs.operation)  : "";
@@ -118,51 +366,203 @@ struct Value {
       _inputs.values[0]->printTree(currentStr.size());
     }
     std::cout << currentStr;
-    if (const bool hasRight = _inputs.values.size() > 1; hasRight) {
-      _inputs.values[1]->printTree(currentStr.size());
+    for (size_t i=1; i<_inputs.values.size(); ++i) {
+      _inputs.values[i]->printTree(currentStr.size());
     }
   }
 
+  // Allocates from the current thread's GraphArena if one is active (see GraphArena::Scope),
+  // otherwise the node is heap allocated and reference counted
   template<typename... Args>
-  static auto make(Args&&... args)
-  {
-    return std::make_shared<Value>(std::forward<Args>(args)...);
+  static auto make(Args&&... args);
+};
+
+// Bump allocator owning the Value nodes of a single expression graph (e.g. one training step)
+// While a GraphArena::Scope is active on a thread, every node created by the operators
+// (and Value::make) is placed into the arena instead of onto the heap:
+// - Nodes are constructed in place within large reusable blocks: no malloc/free per node
+// - Handles to arena nodes and the inputs stored within them do not own what they point to,
+// so copying them does not touch any reference count
+//
+// The caller is responsible for lifetimes: arena nodes are destroyed by reset(),
+// and any heap nodes they reference (e.g. parameters) must outlive the arena's use of them.
+template<typename T>
+class BasicGraphArena {
+  using Value = BasicValue<T>;
+  using ValuePtr = BasicValuePtr<T>;
+
+  static constexpr size_t BlockSize = 4096;
+
+  struct alignas(Value) Slot {
+    std::byte bytes[sizeof(Value)];
+  };
+
+  std::vector<std::unique_ptr<Slot[]>> _blocks;
+  size_t _size = 0;
+
+  static BasicGraphArena*& currentRef() {
+    thread_local BasicGraphArena* arena = nullptr;
+    return arena;
   }
+public:
+  BasicGraphArena() = default;
+  BasicGraphArena(const BasicGraphArena&) = delete;
+  BasicGraphArena& operator=(const BasicGraphArena&) = delete;
+  ~BasicGraphArena() { reset(); }
+
+  // Non-owning handle to a node, suitable for referencing arena (or externally owned) nodes
+  static ValuePtr borrow(Value* value) {
+    return ValuePtr(ValuePtr{}, value);
+  }
+
+  template<typename... Args>
+  ValuePtr make(Args&&... args) {
+    if (_size == _blocks.size() * BlockSize) {
+      _blocks.push_back(std::make_unique<Slot[]>(BlockSize));
+    }
+    auto slot = &_blocks[_size / BlockSize][_size % BlockSize];
+    auto value = new (slot) Value(std::forward<Args>(args)...);
+    ++_size;
+    return borrow(value);
+  }
+
+  // Destroys all nodes, retaining the allocated blocks for the next graph
+  void reset() {
+    for (size_t i=0; i<_size; ++i) {
+      std::launder(reinterpret_cast<Value*>(&_blocks[i / BlockSize][i % BlockSize]))->~Value();
+    }
+    _size = 0;
+  }
+
+  size_t size() const { return _size; }
+  size_t capacity() const { return _blocks.size() * BlockSize; }
+
+  static BasicGraphArena* current() { return currentRef(); }
+
+  // Makes the arena the current one for the calling thread for the lifetime of the scope
+  class Scope {
+    BasicGraphArena* _previous;
+  public:
+    Scope(BasicGraphArena& arena) : _previous(currentRef()) { currentRef() = &arena; }
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+    ~Scope() { currentRef() = _previous; }
+  };
 };
 
-using ValuePtr = std::shared_ptr<Value>;
+template<typename T>
+template<typename... Args>
+auto BasicValue<T>::make(Args&&... args)
+{
+  if (auto arena = BasicGraphArena<T>::current()) {
+    return arena->make(std::forward<Args>(args)...);
+  }
+  return std::make_shared<BasicValue>(std::forward<Args>(args)...);
+}
+
+using Value = BasicValue<double>;
+using ValuePtr = BasicValuePtr<double>;
+using Inputs = BasicInputs<double>;
+using InputSlots = BasicInputSlots<double>;
+using GraphArena = BasicGraphArena<double>;
 
-ValuePtr operator+(ValuePtr a, ValuePtr b)
+// Creates the result node of an operation
+// Within an arena the inputs are borrowed, otherwise the node shares ownership of them
+template<typename T>
+BasicValuePtr<T> makeNode(
+  T value,
+  Operation operation,
+  std::initializer_list<std::reference_wrapper<const BasicValuePtr<T>>> values,
+  T power = 0)
 {
-  return std::make_shared<Value>(a->_value + b->_value, Inputs{ Operation::Addition, { a, b }});
+  const auto arena = BasicGraphArena<T>::current();
+  BasicInputs<T> inputs{ operation, {}, power };
+  for (const BasicValuePtr<T>& v : values) {
+    inputs.values.push_back(arena ? BasicGraphArena<T>::borrow(v.get()) : v);
+  }
+  if (arena) {
+    return arena->make(value, std::move(inputs));
+  }
+  return std::make_shared<BasicValue<T>>(value, std::move(inputs));
 }
-ValuePtr operator*(ValuePtr a, ValuePtr b)
+
+template<typename T>
+BasicValuePtr<T> operator+(const BasicValuePtr<T>& a, const BasicValuePtr<T>& b)
 {
-  return std::make_shared<Value>(a->_value * b->_value, Inputs{ Operation::Multiplication, { a, b }});
+  return makeNode<T>(a->_value + b->_value, Operation::Addition, { a, b });
 }
-ValuePtr power(ValuePtr a, double value)
+template<typename T>
+BasicValuePtr<T> operator*(const BasicValuePtr<T>& a, const BasicValuePtr<T>& b)
 {
-  return std::make_shared<Value>(std::pow(a->_value, value), Inputs{ Operation::Power, { a }, value });
+  return makeNode<T>(a->_value * b->_value, Operation::Multiplication, { a, b });
 }
-ValuePtr operator-(ValuePtr a)
+template<typename T>
+BasicValuePtr<T> power(const BasicValuePtr<T>& a, std::type_identity_t<T> value)
 {
-  return a * std::make_shared<Value>(-1.0);
+  return makeNode<T>(std::pow(a->_value, value), Operation::Power, { a }, value);
 }
-ValuePtr operator/(ValuePtr a, ValuePtr b)
+template<typename T>
+BasicValuePtr<T> operator-(const BasicValuePtr<T>& a)
 {
-  return a * power(b, -1.0);
+  return a * BasicValue<T>::make(T(-1));
 }
-ValuePtr operator-(ValuePtr a, ValuePtr b)
+template<typename T>
+BasicValuePtr<T> operator/(const BasicValuePtr<T>& a, const BasicValuePtr<T>& b)
 {
-  return a + (-b);
+  return makeNode<T>(a->_value / b->_value, Operation::Division, { a, b });
 }
-ValuePtr relu(ValuePtr a)
+template<typename T>
+BasicValuePtr<T> operator-(const BasicValuePtr<T>& a, const BasicValuePtr<T>& b)
 {
-  return std::make_shared<Value>((a->_value > 0.0 ? a->_value : 0.0), Inputs{ Operation::RELU, { a } });
+  return makeNode<T>(a->_value - b->_value, Operation::Subtraction, { a, b });
+}
+// a * b + c as a single node, e.g. one term of a dot product accumulated onto 'c'
+template<typename T>
+BasicValuePtr<T> multiplyAdd(const BasicValuePtr<T>& a, const BasicValuePtr<T>& b, const BasicValuePtr<T>& c)
+{
+  return makeNode<T>(a->_value * b->_value + c->_value, Operation::MultiplyAdd, { a, b, c });
+}
+// (a - b) ^ 2 as a single node
+template<typename T>
+BasicValuePtr<T> squaredError(const BasicValuePtr<T>& a, const BasicValuePtr<T>& b)
+{
+  const auto delta = a->_value - b->_value;
+  return makeNode<T>(delta * delta, Operation::SquaredError, { a, b });
+}
+template<typename T>
+BasicValuePtr<T> relu(const BasicValuePtr<T>& a)
+{
+  return makeNode<T>((a->_value > T(0) ? a->_value : T(0)), Operation::RELU, { a });
 }
 
-std::ostream& operator<<(std::ostream& os, const ValuePtr& value)
+template<typename T>
+std::ostream& operator<<(std::ostream& os, const BasicValuePtr<T>& value)
 {
   os << value->_value;
   return os;
-}
\ No newline at end of file
+}
+
+// Customization point describing how the nn.hpp building blocks create
+// their values (and parameter blocks), allowing them to run on different value engines
+template<typename V>
+struct ValueTraits;
+
+template<typename T>
+struct ValueTraits<BasicValuePtr<T>> {
+  static BasicValuePtr<T> make(double value) { return BasicValue<T>::make(T(value)); }
+
+  // Places the nodes adjacently in a single heap block, kept alive by any of the returned handles
+  static std::vector<BasicValuePtr<T>> makeParameters(std::span<const double> values) {
+    auto block = std::make_shared<std::vector<BasicValue<T>>>();
+    block->reserve(values.size());
+    for (auto value : values) {
+      block->emplace_back(T(value));
+    }
+    std::vector<BasicValuePtr<T>> result;
+    result.reserve(values.size());
+    for (auto& node : *block) {
+      result.emplace_back(block, &node);
+    }
+    return result;
+  }
+};
\ No newline at end of file
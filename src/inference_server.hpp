@@ -0,0 +1,207 @@
+#pragma once
+
+#include "nn.hpp"
+#include "tensor.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+struct InferenceServerOptions {
+  // Most requests evaluated by one forward pass
+  size_t maxBatchSize = 32;
+  // Longest a request waits for others to batch with before its batch is run anyway
+  std::chrono::microseconds maxDelay{500};
+};
+
+// Serves single sample requests from many threads with batched forward passes
+// Requests are queued and coalesced on a background thread: a batch runs as soon as it is full,
+// or once its oldest request has waited maxDelay. Under load batches fill up and one matmul per
+// layer serves them all; a lone request is delayed by at most maxDelay.
+// Pending requests are still completed when the server is destroyed.
+class InferenceServer {
+public:
+  // [batch, inputs] -> [batch, outputs]
+  using Forward = std::function<Tensor(const Tensor&)>;
+  // Called on the server thread with either the output or the error of the forward pass
+  using Callback = std::function<void(std::vector<double> output, std::exception_ptr error)>;
+
+  struct Stats {
+    size_t requests = 0;
+    size_t batches = 0;
+    size_t largestBatch = 0;
+  };
+private:
+  struct Request {
+    std::vector<double> input;
+    std::chrono::steady_clock::time_point arrival;
+    // Set for submit(input, callback), otherwise its future is completed
+    Callback callback;
+    std::promise<std::vector<double>> promise;
+  };
+
+  Forward _forward;
+  size_t _inputs;
+  size_t _outputs;
+  InferenceServerOptions _options;
+  std::deque<Request> _queue;
+  Stats _stats;
+  bool _stop = false;
+  mutable std::mutex _mutex;
+  std::condition_variable _changed;
+  std::thread _thread;
+
+  static void complete(Request& request, std::vector<double> output, std::exception_ptr error) {
+    if (request.callback) {
+      request.callback(std::move(output), error);
+    } else if (error) {
+      request.promise.set_exception(error);
+    } else {
+      request.promise.set_value(std::move(output));
+    }
+  }
+
+  void run(std::vector<Request>& batch) {
+    const auto n = batch.size();
+    const auto inputs = Tensor::generate({ n, _inputs }, [&](size_t index) { return batch[index / _inputs].input[index % _inputs]; });
+    try {
+      const auto result = _forward(inputs).contiguous();
+      if (result.shape() != std::vector<size_t>{ n, _outputs }) {
+        throw std::runtime_error("Forward output shape does not match the batch");
+      }
+      const auto data = result.data();
+      for (size_t r=0; r<n; ++r) {
+        const auto row = data.subspan(r * _outputs, _outputs);
+        complete(batch[r], std::vector<double>(row.begin(), row.end()), nullptr);
+      }
+    } catch (...) {
+      const auto error = std::current_exception();
+      for (auto& request : batch) {
+        complete(request, {}, error);
+      }
+    }
+  }
+
+  void serve() {
+    std::vector<Request> batch;
+    while (true) {
+      {
+        std::unique_lock lock(_mutex);
+        _changed.wait(lock, [&]() { return _stop || !_queue.empty(); });
+        if (_queue.empty()) {
+          return;
+        }
+        const auto deadline = _queue.front().arrival + _options.maxDelay;
+        _changed.wait_until(lock, deadline, [&]() { return _stop || _queue.size() >= _options.maxBatchSize; });
+        const auto n = std::min(_queue.size(), _options.maxBatchSize);
+        batch.assign(std::make_move_iterator(_queue.begin()), std::make_move_iterator(_queue.begin() + n));
+        _queue.erase(_queue.begin(), _queue.begin() + n);
+        _stats.requests += n;
+        ++_stats.batches;
+        _stats.largestBatch = std::max(_stats.largestBatch, n);
+      }
+      run(batch);
+      batch.clear();
+    }
+  }
+
+  void enqueue(Request request) {
+    if (request.input.size() != _inputs) {
+      throw std::runtime_error("Request input size does not match the model");
+    }
+    request.arrival = std::chrono::steady_clock::now();
+    bool wake;
+    {
+      std::lock_guard lock(_mutex);
+      _queue.push_back(std::move(request));
+      // The server only waits on the first request of a batch and on the batch filling up
+      wake = _queue.size() == 1 || _queue.size() >= _options.maxBatchSize;
+    }
+    if (wake) {
+      _changed.notify_one();
+    }
+  }
+
+  // Linear layers as MultilayerPerceptron evaluates them, with weights transposed to [inputs, outputs]
+  static Forward snapshot(const MultilayerPerceptron& model) {
+    std::vector<std::pair<Tensor, Tensor>> layers;
+    for (const auto& l : model.layers()) {
+      const auto in = l.numberOfInputs();
+      const auto out = l.numberOfOutputs();
+      const auto w = l.weights();
+      const auto b = l.biases();
+      std::vector<double> weights(in * out);
+      std::vector<double> biases(out);
+      for (size_t o=0; o<out; ++o) {
+        for (size_t i=0; i<in; ++i) {
+          weights[i * out + o] = w[o * in + i]->_value;
+        }
+        biases[o] = b[o]->_value;
+      }
+      layers.emplace_back(Tensor(weights, { in, out }), Tensor(biases, { 1, out }));
+    }
+    return [layers = std::move(layers)](const Tensor& batch) {
+      auto x = batch;
+      for (const auto& [weights, biases] : layers) {
+        x = x.matmul(weights) + biases;
+      }
+      return x;
+    };
+  }
+public:
+  InferenceServer(Forward forward, size_t inputs, size_t outputs, InferenceServerOptions options = {})
+  : _forward(std::move(forward)), _inputs(inputs), _outputs(outputs), _options(options)
+  {
+    if (_options.maxBatchSize == 0) {
+      throw std::runtime_error("Batch size must be positive");
+    }
+    _thread = std::thread([this]() { serve(); });
+  }
+  // Serves the model's current parameter values: later training does not affect the server
+  explicit InferenceServer(const MultilayerPerceptron& model, InferenceServerOptions options = {})
+  : InferenceServer(snapshot(model), model.layers().front().numberOfInputs(), model.layers().back().numberOfOutputs(), options)
+  {}
+  // Shares the model's parameters, which must not be updated while the server runs
+  explicit InferenceServer(const TensorMultilayerPerceptron& model, InferenceServerOptions options = {})
+  : InferenceServer([model = TensorMultilayerPerceptron(model)](const Tensor& batch) mutable { return model(batch)->_value; },
+      model.neuronsPerLayer().front(), model.neuronsPerLayer().back(), options)
+  {}
+  InferenceServer(const InferenceServer&) = delete;
+  InferenceServer& operator=(const InferenceServer&) = delete;
+  ~InferenceServer() {
+    {
+      std::lock_guard lock(_mutex);
+      _stop = true;
+    }
+    _changed.notify_all();
+    _thread.join();
+  }
+
+  // Output of the model for one sample of numberOfInputs() values
+  std::future<std::vector<double>> submit(std::vector<double> input) {
+    Request request{ std::move(input), {}, {}, {} };
+    auto result = request.promise.get_future();
+    enqueue(std::move(request));
+    return result;
+  }
+  void submit(std::vector<double> input, Callback callback) {
+    enqueue({ std::move(input), {}, std::move(callback), {} });
+  }
+
+  size_t numberOfInputs() const { return _inputs; }
+  size_t numberOfOutputs() const { return _outputs; }
+
+  // Requests batched and batches run so far
+  Stats stats() const {
+    std::lock_guard lock(_mutex);
+    return _stats;
+  }
+};
\ No newline at end of file
@@ -0,0 +1,570 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "scalar.hpp"
+#include "thread_pool.hpp"
+
+#if defined(__AVX512F__) || (defined(__AVX2__) && defined(__FMA__))
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Matrix multiplication kernels: C += A * B
+// with A: [m, k], B: [k, n], C: [m, n] (row-major with row stride 'ldc')
+// A and B are addressed through separate row ('rs*') and column ('cs*') strides,
+// so transposed views can be multiplied without first being copied
+//
+// The blocked kernel follows the usual packed GEMM structure:
+// - B is packed in [kc, nc] panels and A in [mc, kc] blocks sized to stay cache resident
+// - Packed panels are laid out as MR row / NR column slivers so the micro-kernel
+//   streams through them linearly
+// - The micro-kernel keeps an MR x NR tile of C in registers for the whole kc loop
+// The micro-kernel is selected at compile time for the target instruction set
+// (AVX-512, AVX2+FMA, NEON, or portable C++ the compiler can auto-vectorize).
+//
+// Inputs of any element type are converted to their ComputeType while being packed,
+// so float16/bfloat16 matrices are multiplied and accumulated in float.
+// The accumulator type can also be given explicitly, e.g. int8 matrices accumulated in int32.
+namespace kernels {
+
+// Portable micro-kernel
+template<typename C>
+struct MicroKernel {
+  static constexpr size_t MR = 4;
+  static constexpr size_t NR = 4;
+
+  static void run(size_t kc, const C* a, const C* b, C* c, size_t ldc)
+  {
+    C acc[MR][NR];
+    for (size_t i=0; i<MR; ++i) {
+      for (size_t j=0; j<NR; ++j) {
+        acc[i][j] = c[i*ldc + j];
+      }
+    }
+    for (size_t p=0; p<kc; ++p) {
+      for (size_t i=0; i<MR; ++i) {
+        const auto ai = a[p*MR + i];
+        for (size_t j=0; j<NR; ++j) {
+          acc[i][j] += ai * b[p*NR + j];
+        }
+      }
+    }
+    for (size_t i=0; i<MR; ++i) {
+      for (size_t j=0; j<NR; ++j) {
+        c[i*ldc + j] = acc[i][j];
+      }
+    }
+  }
+};
+
+#if defined(__AVX512F__)
+template<>
+struct MicroKernel<double> {
+  static constexpr size_t MR = 8;
+  static constexpr size_t NR = 16;
+
+  static void run(size_t kc, const double* a, const double* b, double* c, size_t ldc)
+  {
+    __m512d acc[MR][2];
+    for (size_t i=0; i<MR; ++i) {
+      acc[i][0] = _mm512_loadu_pd(c + i*ldc);
+      acc[i][1] = _mm512_loadu_pd(c + i*ldc + 8);
+    }
+    for (size_t p=0; p<kc; ++p) {
+      const auto b0 = _mm512_loadu_pd(b + p*NR);
+      const auto b1 = _mm512_loadu_pd(b + p*NR + 8);
+      for (size_t i=0; i<MR; ++i) {
+        const auto ai = _mm512_set1_pd(a[p*MR + i]);
+        acc[i][0] = _mm512_fmadd_pd(ai, b0, acc[i][0]);
+        acc[i][1] = _mm512_fmadd_pd(ai, b1, acc[i][1]);
+      }
+    }
+    for (size_t i=0; i<MR; ++i) {
+      _mm512_storeu_pd(c + i*ldc, acc[i][0]);
+      _mm512_storeu_pd(c + i*ldc + 8, acc[i][1]);
+    }
+  }
+};
+
+template<>
+struct MicroKernel<float> {
+  static constexpr size_t MR = 8;
+  static constexpr size_t NR = 32;
+
+  static void run(size_t kc, const float* a, const float* b, float* c, size_t ldc)
+  {
+    __m512 acc[MR][2];
+    for (size_t i=0; i<MR; ++i) {
+      acc[i][0] = _mm512_loadu_ps(c + i*ldc);
+      acc[i][1] = _mm512_loadu_ps(c + i*ldc + 16);
+    }
+    for (size_t p=0; p<kc; ++p) {
+      const auto b0 = _mm512_loadu_ps(b + p*NR);
+      const auto b1 = _mm512_loadu_ps(b + p*NR + 16);
+      for (size_t i=0; i<MR; ++i) {
+        const auto ai = _mm512_set1_ps(a[p*MR + i]);
+        acc[i][0] = _mm512_fmadd_ps(ai, b0, acc[i][0]);
+        acc[i][1] = _mm512_fmadd_ps(ai, b1, acc[i][1]);
+      }
+    }
+    for (size_t i=0; i<MR; ++i) {
+      _mm512_storeu_ps(c + i*ldc, acc[i][0]);
+      _mm512_storeu_ps(c + i*ldc + 16, acc[i][1]);
+    }
+  }
+};
+
+// Integer products (e.g. int8 quantized matrices, accumulated in int32)
+// Packed with k in pairs (see PackedPairs): one madd multiplies two consecutive k values
+// of 16 columns and sums each pair, twice the work per instruction of a 32 bit multiply
+#if defined(__AVX512BW__)
+template<>
+struct MicroKernel<int32_t> {
+  static constexpr size_t MR = 8;
+  static constexpr size_t NR = 32;
+  static constexpr bool PackedPairs = true;
+
+  static void run(size_t kp, const int32_t* a, const int32_t* b, int32_t* c, size_t ldc)
+  {
+    __m512i acc[MR][2];
+    for (size_t i=0; i<MR; ++i) {
+      acc[i][0] = _mm512_loadu_si512(c + i*ldc);
+      acc[i][1] = _mm512_loadu_si512(c + i*ldc + 16);
+    }
+    for (size_t p=0; p<kp; ++p) {
+      const auto b0 = _mm512_loadu_si512(b + p*NR);
+      const auto b1 = _mm512_loadu_si512(b + p*NR + 16);
+      for (size_t i=0; i<MR; ++i) {
+        const auto ai = _mm512_set1_epi32(a[p*MR + i]);
+#if defined(__AVX512VNNI__)
+        acc[i][0] = _mm512_dpwssd_epi32(acc[i][0], ai, b0);
+        acc[i][1] = _mm512_dpwssd_epi32(acc[i][1], ai, b1);
+#else
+        acc[i][0] = _mm512_add_epi32(acc[i][0], _mm512_madd_epi16(ai, b0));
+        acc[i][1] = _mm512_add_epi32(acc[i][1], _mm512_madd_epi16(ai, b1));
+#endif
+      }
+    }
+    for (size_t i=0; i<MR; ++i) {
+      _mm512_storeu_si512(c + i*ldc, acc[i][0]);
+      _mm512_storeu_si512(c + i*ldc + 16, acc[i][1]);
+    }
+  }
+};
+#endif
+#elif defined(__AVX2__) && defined(__FMA__)
+template<>
+struct MicroKernel<double> {
+  static constexpr size_t MR = 6;
+  static constexpr size_t NR = 8;
+
+  static void run(size_t kc, const double* a, const double* b, double* c, size_t ldc)
+  {
+    __m256d acc[MR][2];
+    for (size_t i=0; i<MR; ++i) {
+      acc[i][0] = _mm256_loadu_pd(c + i*ldc);
+      acc[i][1] = _mm256_loadu_pd(c + i*ldc + 4);
+    }
+    for (size_t p=0; p<kc; ++p) {
+      const auto b0 = _mm256_loadu_pd(b + p*NR);
+      const auto b1 = _mm256_loadu_pd(b + p*NR + 4);
+      for (size_t i=0; i<MR; ++i) {
+        const auto ai = _mm256_broadcast_sd(a + p*MR + i);
+        acc[i][0] = _mm256_fmadd_pd(ai, b0, acc[i][0]);
+        acc[i][1] = _mm256_fmadd_pd(ai, b1, acc[i][1]);
+      }
+    }
+    for (size_t i=0; i<MR; ++i) {
+      _mm256_storeu_pd(c + i*ldc, acc[i][0]);
+      _mm256_storeu_pd(c + i*ldc + 4, acc[i][1]);
+    }
+  }
+};
+
+template<>
+struct MicroKernel<float> {
+  static constexpr size_t MR = 6;
+  static constexpr size_t NR = 16;
+
+  static void run(size_t kc, const float* a, const float* b, float* c, size_t ldc)
+  {
+    __m256 acc[MR][2];
+    for (size_t i=0; i<MR; ++i) {
+      acc[i][0] = _mm256_loadu_ps(c + i*ldc);
+      acc[i][1] = _mm256_loadu_ps(c + i*ldc + 8);
+    }
+    for (size_t p=0; p<kc; ++p) {
+      const auto b0 = _mm256_loadu_ps(b + p*NR);
+      const auto b1 = _mm256_loadu_ps(b + p*NR + 8);
+      for (size_t i=0; i<MR; ++i) {
+        const auto ai = _mm256_broadcast_ss(a + p*MR + i);
+        acc[i][0] = _mm256_fmadd_ps(ai, b0, acc[i][0]);
+        acc[i][1] = _mm256_fmadd_ps(ai, b1, acc[i][1]);
+      }
+    }
+    for (size_t i=0; i<MR; ++i) {
+      _mm256_storeu_ps(c + i*ldc, acc[i][0]);
+      _mm256_storeu_ps(c + i*ldc + 8, acc[i][1]);
+    }
+  }
+};
+
+template<>
+struct MicroKernel<int32_t> {
+  static constexpr size_t MR = 6;
+  static constexpr size_t NR = 16;
+  static constexpr bool PackedPairs = true;
+
+  static void run(size_t kp, const int32_t* a, const int32_t* b, int32_t* c, size_t ldc)
+  {
+    __m256i acc[MR][2];
+    for (size_t i=0; i<MR; ++i) {
+      acc[i][0] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c + i*ldc));
+      acc[i][1] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c + i*ldc + 8));
+    }
+    for (size_t p=0; p<kp; ++p) {
+      const auto b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + p*NR));
+      const auto b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + p*NR + 8));
+      for (size_t i=0; i<MR; ++i) {
+        const auto ai = _mm256_set1_epi32(a[p*MR + i]);
+        acc[i][0] = _mm256_add_epi32(acc[i][0], _mm256_madd_epi16(ai, b0));
+        acc[i][1] = _mm256_add_epi32(acc[i][1], _mm256_madd_epi16(ai, b1));
+      }
+    }
+    for (size_t i=0; i<MR; ++i) {
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(c + i*ldc), acc[i][0]);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(c + i*ldc + 8), acc[i][1]);
+    }
+  }
+};
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+template<>
+struct MicroKernel<double> {
+  static constexpr size_t MR = 4;
+  static constexpr size_t NR = 8;
+
+  static void run(size_t kc, const double* a, const double* b, double* c, size_t ldc)
+  {
+    float64x2_t acc[MR][4];
+    for (size_t i=0; i<MR; ++i) {
+      for (size_t j=0; j<4; ++j) {
+        acc[i][j] = vld1q_f64(c + i*ldc + j*2);
+      }
+    }
+    for (size_t p=0; p<kc; ++p) {
+      float64x2_t bp[4];
+      for (size_t j=0; j<4; ++j) {
+        bp[j] = vld1q_f64(b + p*NR + j*2);
+      }
+      for (size_t i=0; i<MR; ++i) {
+        const auto ai = a[p*MR + i];
+        for (size_t j=0; j<4; ++j) {
+          acc[i][j] = vfmaq_n_f64(acc[i][j], bp[j], ai);
+        }
+      }
+    }
+    for (size_t i=0; i<MR; ++i) {
+      for (size_t j=0; j<4; ++j) {
+        vst1q_f64(c + i*ldc + j*2, acc[i][j]);
+      }
+    }
+  }
+};
+
+template<>
+struct MicroKernel<float> {
+  static constexpr size_t MR = 4;
+  static constexpr size_t NR = 16;
+
+  static void run(size_t kc, const float* a, const float* b, float* c, size_t ldc)
+  {
+    float32x4_t acc[MR][4];
+    for (size_t i=0; i<MR; ++i) {
+      for (size_t j=0; j<4; ++j) {
+        acc[i][j] = vld1q_f32(c + i*ldc + j*4);
+      }
+    }
+    for (size_t p=0; p<kc; ++p) {
+      float32x4_t bp[4];
+      for (size_t j=0; j<4; ++j) {
+        bp[j] = vld1q_f32(b + p*NR + j*4);
+      }
+      for (size_t i=0; i<MR; ++i) {
+        const auto ai = a[p*MR + i];
+        for (size_t j=0; j<4; ++j) {
+          acc[i][j] = vfmaq_n_f32(acc[i][j], bp[j], ai);
+        }
+      }
+    }
+    for (size_t i=0; i<MR; ++i) {
+      for (size_t j=0; j<4; ++j) {
+        vst1q_f32(c + i*ldc + j*4, acc[i][j]);
+      }
+    }
+  }
+};
+#endif
+
+// Cache blocking sizes (multiples of every MR/NR above)
+constexpr size_t KC = 256;
+constexpr size_t MC = 96;
+constexpr size_t NC = 2048;
+
+// Packs a [mc, kc] block of A into MR row slivers, zero padding the last one
+template<typename C, typename T>
+void packA(size_t mc, size_t kc, const T* a, size_t rsa, size_t csa, C* packed)
+{
+  constexpr auto MR = MicroKernel<C>::MR;
+  for (size_t ir=0; ir<mc; ir+=MR) {
+    const auto rows = std::min(MR, mc - ir);
+    for (size_t p=0; p<kc; ++p) {
+      for (size_t i=0; i<rows; ++i) {
+        packed[i] = C(a[(ir+i)*rsa + p*csa]);
+      }
+      for (size_t i=rows; i<MR; ++i) {
+        packed[i] = C(0);
+      }
+      packed += MR;
+    }
+  }
+}
+
+// Packs a [kc, nc] panel of B into NR column slivers, zero padding the last one
+template<typename C, typename T>
+void packB(size_t kc, size_t nc, const T* b, size_t rsb, size_t csb, C* packed)
+{
+  constexpr auto NR = MicroKernel<C>::NR;
+  for (size_t jr=0; jr<nc; jr+=NR) {
+    const auto cols = std::min(NR, nc - jr);
+    for (size_t p=0; p<kc; ++p) {
+      const auto row = b + p*rsb + jr*csb;
+      for (size_t j=0; j<cols; ++j) {
+        packed[j] = C(row[j*csb]);
+      }
+      for (size_t j=cols; j<NR; ++j) {
+        packed[j] = C(0);
+      }
+      packed += NR;
+    }
+  }
+}
+
+// Micro-kernels declaring PackedPairs take k two at a time: each packed element holds the
+// values at k and k+1 as the low and high int16 halves (the operand layout of madd)
+template<typename C>
+constexpr bool PackedPairs = requires { requires MicroKernel<C>::PackedPairs; };
+
+template<typename T>
+int32_t packPair(T low, T high)
+{
+  return int32_t(uint32_t(uint16_t(int16_t(low))) | (uint32_t(uint16_t(int16_t(high))) << 16));
+}
+
+// As packA, interleaving k pairs (an odd kc is padded with a zero)
+template<typename C, typename T>
+void packPairsA(size_t mc, size_t kc, const T* a, size_t rsa, size_t csa, C* packed)
+{
+  constexpr auto MR = MicroKernel<C>::MR;
+  for (size_t ir=0; ir<mc; ir+=MR) {
+    const auto rows = std::min(MR, mc - ir);
+    for (size_t p=0; p<kc; p+=2) {
+      for (size_t i=0; i<rows; ++i) {
+        const auto row = a + (ir+i)*rsa;
+        packed[i] = packPair(row[p*csa], p+1 < kc ? row[(p+1)*csa] : T(0));
+      }
+      for (size_t i=rows; i<MR; ++i) {
+        packed[i] = C(0);
+      }
+      packed += MR;
+    }
+  }
+}
+
+// As packB, interleaving k pairs (an odd kc is padded with a zero)
+template<typename C, typename T>
+void packPairsB(size_t kc, size_t nc, const T* b, size_t rsb, size_t csb, C* packed)
+{
+  constexpr auto NR = MicroKernel<C>::NR;
+  for (size_t jr=0; jr<nc; jr+=NR) {
+    const auto cols = std::min(NR, nc - jr);
+    for (size_t p=0; p<kc; p+=2) {
+      const auto row = b + p*rsb + jr*csb;
+      for (size_t j=0; j<cols; ++j) {
+        packed[j] = packPair(row[j*csb], p+1 < kc ? row[rsb + j*csb] : T(0));
+      }
+      for (size_t j=cols; j<NR; ++j) {
+        packed[j] = C(0);
+      }
+      packed += NR;
+    }
+  }
+}
+
+// Multiplies the packed [mc, kc] block by the packed [kc, nc] panel into C
+template<typename C>
+void macroKernel(size_t mc, size_t nc, size_t kc, const C* packedA, const C* packedB, C* c, size_t ldc)
+{
+  constexpr auto MR = MicroKernel<C>::MR;
+  constexpr auto NR = MicroKernel<C>::NR;
+  for (size_t jr=0; jr<nc; jr+=NR) {
+    const auto cols = std::min(NR, nc - jr);
+    for (size_t ir=0; ir<mc; ir+=MR) {
+      const auto rows = std::min(MR, mc - ir);
+      const auto a = packedA + ir*kc;
+      const auto b = packedB + jr*kc;
+      auto ct = c + ir*ldc + jr;
+      if (rows == MR && cols == NR) {
+        MicroKernel<C>::run(kc, a, b, ct, ldc);
+      } else {
+        // Edge tile: accumulate into a full sized scratch tile and copy the valid part
+        C tile[MR*NR] = {};
+        MicroKernel<C>::run(kc, a, b, tile, NR);
+        for (size_t i=0; i<rows; ++i) {
+          for (size_t j=0; j<cols; ++j) {
+            ct[i*ldc + j] += tile[i*NR + j];
+          }
+        }
+      }
+    }
+  }
+}
+
+// Skinny shapes, where packing cannot be amortized, are handled without packing:
+// Few rows of A: each row of C accumulates scaled rows of B (streams B once)
+template<typename T, typename C = ComputeType<T>>
+void gemmFewRows(size_t m, size_t n, size_t k, const T* a, size_t rsa, size_t csa, const T* b, size_t rsb, size_t csb, C* c, size_t ldc)
+{
+  for (size_t i=0; i<m; ++i) {
+    auto ci = c + i*ldc;
+    for (size_t p=0; p<k; ++p) {
+      const auto aip = C(a[i*rsa + p*csa]);
+      const auto bp = b + p*rsb;
+      if (csb == 1) {
+        for (size_t j=0; j<n; ++j) {
+          ci[j] += aip * C(bp[j]);
+        }
+      } else {
+        for (size_t j=0; j<n; ++j) {
+          ci[j] += aip * C(bp[j*csb]);
+        }
+      }
+    }
+  }
+}
+
+// Few columns of B: each element of C is a dot product of a row of A and a column of B
+template<typename T, typename C = ComputeType<T>>
+void gemmFewColumns(size_t m, size_t n, size_t k, const T* a, size_t rsa, size_t csa, const T* b, size_t rsb, size_t csb, C* c, size_t ldc)
+{
+  for (size_t i=0; i<m; ++i) {
+    const auto ai = a + i*rsa;
+    for (size_t j=0; j<n; ++j) {
+      // Independent partial sums so the reduction can be vectorized
+      C sums[4] = {};
+      size_t p = 0;
+      for (; p+4<=k; p+=4) {
+        for (size_t q=0; q<4; ++q) {
+          sums[q] += C(ai[(p+q)*csa]) * C(b[(p+q)*rsb + j*csb]);
+        }
+      }
+      for (; p<k; ++p) {
+        sums[0] += C(ai[p*csa]) * C(b[p*rsb + j*csb]);
+      }
+      c[i*ldc + j] += (sums[0] + sums[1]) + (sums[2] + sums[3]);
+    }
+  }
+}
+
+template<typename T, typename C = ComputeType<T>>
+void gemm(size_t m, size_t n, size_t k, const T* a, size_t rsa, size_t csa, const T* b, size_t rsb, size_t csb, C* c, size_t ldc)
+{
+  constexpr auto MR = MicroKernel<C>::MR;
+  constexpr auto NR = MicroKernel<C>::NR;
+  if (m < MR) {
+    return gemmFewRows(m, n, k, a, rsa, csa, b, rsb, csb, c, ldc);
+  }
+  if (n < NR) {
+    return gemmFewColumns(m, n, k, a, rsa, csa, b, rsb, csb, c, ldc);
+  }
+
+  // Packing buffers are reused across calls
+  thread_local std::vector<C> packedA;
+  thread_local std::vector<C> packedB;
+  packedA.resize(MC * KC);
+  packedB.resize(KC * ((NC + NR - 1) / NR) * NR);
+
+  for (size_t jc=0; jc<n; jc+=NC) {
+    const auto nc = std::min(NC, n - jc);
+    for (size_t pc=0; pc<k; pc+=KC) {
+      const auto kc = std::min(KC, k - pc);
+      if constexpr (PackedPairs<C>) {
+        static_assert(std::is_integral_v<T> && sizeof(T) <= 2, "Pairs are packed as int16");
+        packPairsB(kc, nc, b + pc*rsb + jc*csb, rsb, csb, packedB.data());
+      } else {
+        packB(kc, nc, b + pc*rsb + jc*csb, rsb, csb, packedB.data());
+      }
+      for (size_t ic=0; ic<m; ic+=MC) {
+        const auto mc = std::min(MC, m - ic);
+        if constexpr (PackedPairs<C>) {
+          packPairsA(mc, kc, a + ic*rsa + pc*csa, rsa, csa, packedA.data());
+          macroKernel(mc, nc, (kc + 1) / 2, packedA.data(), packedB.data(), c + ic*ldc + jc, ldc);
+        } else {
+          packA(mc, kc, a + ic*rsa + pc*csa, rsa, csa, packedA.data());
+          macroKernel(mc, nc, kc, packedA.data(), packedB.data(), c + ic*ldc + jc, ldc);
+        }
+      }
+    }
+  }
+}
+
+// Row-major A and B
+template<typename T, typename C = ComputeType<T>>
+void gemm(size_t m, size_t n, size_t k, const T* a, size_t lda, const T* b, size_t ldb, C* c, size_t ldc)
+{
+  gemm(m, n, k, a, lda, 1, b, ldb, 1, c, ldc);
+}
+
+// Splits C into tiles which are multiplied independently across the pool
+// Small products are not worth distributing and run on the calling thread
+template<typename T, typename C = ComputeType<T>>
+void gemmParallel(ThreadPool& pool, size_t m, size_t n, size_t k, const T* a, size_t rsa, size_t csa, const T* b, size_t rsb, size_t csb, C* c, size_t ldc)
+{
+  constexpr size_t TileRows = MC;
+  constexpr size_t TileColumns = 256;
+  constexpr size_t ParallelFlops = size_t(1) << 21;
+  if (pool.size() == 1 || m * n * k < ParallelFlops) {
+    return gemm(m, n, k, a, rsa, csa, b, rsb, csb, c, ldc);
+  }
+  const auto rowTiles = (m + TileRows - 1) / TileRows;
+  const auto columnTiles = (n + TileColumns - 1) / TileColumns;
+  pool.parallelFor(0, rowTiles * columnTiles, 1, [&](size_t begin, size_t end) {
+    for (auto t=begin; t<end; ++t) {
+      const auto i = (t / columnTiles) * TileRows;
+      const auto j = (t % columnTiles) * TileColumns;
+      gemm(std::min(TileRows, m - i), std::min(TileColumns, n - j), k, a + i*rsa, rsa, csa, b + j*csb, rsb, csb, c + i*ldc + j, ldc);
+    }
+  });
+}
+
+// Straightforward i-j-k triple loop, kept as the reference the blocked kernel is checked and benchmarked against
+template<typename T, typename C = ComputeType<T>>
+void gemmReference(size_t m, size_t n, size_t k, const T* a, size_t lda, const T* b, size_t ldb, C* c, size_t ldc)
+{
+  for (size_t i=0; i<m; ++i) {
+    for (size_t j=0; j<n; ++j) {
+      C sum = 0;
+      for (size_t p=0; p<k; ++p) {
+        sum += C(a[i*lda + p]) * C(b[p*ldb + j]);
+      }
+      c[i*ldc + j] += sum;
+    }
+  }
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Size-class caching allocator for tensor storage
+// Requests are rounded up to a power of two (at least one cache line), and freed blocks are kept
+// on their class' free list instead of being returned to the system, so the buffers of a training
+// step are reused by the next one: once warmed up, a loop over same-shaped tensors is served
+// entirely from the cache (see stats(): every allocation is then a hit).
+// Blocks are 64 byte aligned, the widest SIMD load used by the kernels.
+class MemoryPool {
+public:
+  static constexpr size_t Alignment = 64;
+
+  struct Stats {
+    // Allocations served from the cache
+    size_t hits = 0;
+    // Allocations passed on to the system allocator
+    size_t misses = 0;
+    size_t cachedBytes = 0;
+  };
+private:
+  static constexpr size_t Classes = 64;
+
+  struct SizeClass {
+    std::mutex mutex;
+    std::vector<void*> blocks;
+  };
+
+  std::array<SizeClass, Classes> _classes;
+  size_t _maxCachedBytes;
+  std::atomic<size_t> _hits{0};
+  std::atomic<size_t> _misses{0};
+  std::atomic<size_t> _cachedBytes{0};
+
+  static size_t classOf(size_t bytes) {
+    return std::bit_width(std::max(bytes, Alignment) - 1);
+  }
+public:
+  // Freed blocks beyond 'maxCachedBytes' in total are released to the system
+  MemoryPool(size_t maxCachedBytes = size_t(1) << 30) : _maxCachedBytes(maxCachedBytes)
+  {}
+  MemoryPool(const MemoryPool&) = delete;
+  MemoryPool& operator=(const MemoryPool&) = delete;
+  ~MemoryPool() { trim(); }
+
+  // Shared by all tensors; never destroyed, so storage may outlive other static objects
+  static MemoryPool& global() {
+    static auto pool = new MemoryPool();
+    return *pool;
+  }
+
+  void* allocate(size_t bytes) {
+    const auto c = classOf(bytes);
+    {
+      auto& sizeClass = _classes[c];
+      std::lock_guard lock(sizeClass.mutex);
+      if (!sizeClass.blocks.empty()) {
+        auto block = sizeClass.blocks.back();
+        sizeClass.blocks.pop_back();
+        _cachedBytes -= size_t(1) << c;
+        ++_hits;
+        return block;
+      }
+    }
+    ++_misses;
+    return ::operator new(size_t(1) << c, std::align_val_t(Alignment));
+  }
+
+  // 'bytes' must be the size the block was allocated with
+  void deallocate(void* block, size_t bytes) {
+    const auto c = classOf(bytes);
+    const auto blockSize = size_t(1) << c;
+    if (_cachedBytes.fetch_add(blockSize) + blockSize <= _maxCachedBytes) {
+      auto& sizeClass = _classes[c];
+      std::lock_guard lock(sizeClass.mutex);
+      sizeClass.blocks.push_back(block);
+      return;
+    }
+    _cachedBytes -= blockSize;
+    ::operator delete(block, std::align_val_t(Alignment));
+  }
+
+  // Returns every cached block to the system
+  void trim() {
+    for (size_t c=0; c<Classes; ++c) {
+      auto& sizeClass = _classes[c];
+      std::lock_guard lock(sizeClass.mutex);
+      for (auto block : sizeClass.blocks) {
+        ::operator delete(block, std::align_val_t(Alignment));
+      }
+      _cachedBytes -= sizeClass.blocks.size() << c;
+      sizeClass.blocks.clear();
+    }
+  }
+
+  Stats stats() const { return { _hits.load(), _misses.load(), _cachedBytes.load() }; }
+  void resetStats() {
+    _hits = 0;
+    _misses = 0;
+  }
+
+  // Storage for 'size' elements (default initialized) returned to the pool once the last owner releases it
+  // The shared_ptr control block is allocated from the pool too
+  template<typename T>
+  std::shared_ptr<T[]> makeShared(size_t size);
+};
+
+// Standard allocator interface over a MemoryPool
+template<typename T>
+class PoolAllocator {
+  template<typename U>
+  friend class PoolAllocator;
+
+  MemoryPool* _pool;
+public:
+  using value_type = T;
+
+  PoolAllocator(MemoryPool& pool = MemoryPool::global()) : _pool(&pool)
+  {}
+  template<typename U>
+  PoolAllocator(const PoolAllocator<U>& other) : _pool(other._pool)
+  {}
+
+  T* allocate(size_t n) { return static_cast<T*>(_pool->allocate(n * sizeof(T))); }
+  void deallocate(T* p, size_t n) { _pool->deallocate(p, n * sizeof(T)); }
+
+  template<typename U>
+  bool operator==(const PoolAllocator<U>& other) const { return _pool == other._pool; }
+};
+
+template<typename T>
+std::shared_ptr<T[]> MemoryPool::makeShared(size_t size)
+{
+  static_assert(std::is_trivially_destructible_v<T>, "Pooled storage is released without destroying its elements");
+  const auto bytes = std::max<size_t>(size, 1) * sizeof(T);
+  auto data = static_cast<T*>(allocate(bytes));
+  if constexpr (!std::is_trivially_default_constructible_v<T>) {
+    std::uninitialized_default_construct_n(data, size);
+  }
+  return std::shared_ptr<T[]>(data, [this, bytes](T* p) { deallocate(p, bytes); }, PoolAllocator<T>(*this));
+}
\ No newline at end of file
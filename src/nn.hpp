@@ -1,70 +1,173 @@
 #pragma once
 
 #include "engine.hpp"
+#include "tensor_engine.hpp"
+#include "optimizer.hpp"
+#include "profiler.hpp"
 #include <random>
+#include <span>
+
+// The building blocks are templated on the value type so they can run on
+// either the graph engine (ValuePtr) or the tape engine (TapeValue, see tape.hpp)
+// See ValueTraits for what a value type needs to provide
 
 // N scalar inputs -> 1 scalar output
 // Maintains a 'weight' multiplier for each input to manipulate effect
 // Has an overall bias to control overall firing
-class Neuron {
-  std::vector<ValuePtr> _weights;
-  ValuePtr _bias;
-
-  static auto generateWeights(size_t numberOfInputs) {
-    std::random_device rd{};
-    std::mt19937 twister(rd());
-    std::vector<ValuePtr> result;
-    std::generate_n(std::back_inserter(result), numberOfInputs, [&]() {
-      return Value::make(std::uniform_real_distribution<double>(-1.0, 1.0)(twister));
-    });
-    return result;
-  }
+// Note: a view of one row of its layer's weight matrix and the matching bias (see BasicLayer)
+template<typename V>
+class BasicNeuron {
+  std::span<const V> _weights;
+  V _bias;
 public:
-  Neuron(size_t numberOfInputs) : _weights(generateWeights(numberOfInputs)), _bias(Value::make(0.0))
+  BasicNeuron(std::span<const V> weights, V bias) : _weights(weights), _bias(std::move(bias))
   {}
 
-  ValuePtr operator()(const std::vector<ValuePtr>& input) {
+  V operator()(const std::vector<V>& input) const {
     auto sum = _bias;
     for (size_t i = 0; i<input.size(); ++i) {
-      sum = sum + (input[i]* _weights[i]);
+      sum = multiplyAdd(input[i], _weights[i], sum);
     }
     return sum;
   }
-
-  auto parameters() {
-    std::vector<Value*> params;
-    for (auto& w : _weights) {
-      params.push_back(w.get());
-    }
-    params.push_back(_bias.get());
-    return params;
-  }
 };
 
 // N scalar inputs -> X scalar outputs (X being number of neurons)
 // Computed by feeding the inputs to each Neuron in the layer
 // and including the single scalar output in the result
-class Layer {
-  std::vector<Neuron> _neurons;
+//
+// The parameters are laid out contiguously as an [X, N] row-major weight matrix
+// (row x holding neuron x's weights) followed by the X biases. They are a range of
+// storage shared with the other layers of the model, so parameters() is a cheap span
+template<typename V>
+class BasicLayer {
+  using Traits = ValueTraits<V>;
+
+  std::shared_ptr<const std::vector<V>> _storage;
+  size_t _offset;
+  size_t _numberOfInputs;
+  size_t _numberOfOutputs;
 public:
-  Layer(size_t numberOfInputs, size_t numberOfOutputs) : _neurons(numberOfOutputs, Neuron(numberOfInputs))
+  static size_t parameterCount(size_t numberOfInputs, size_t numberOfOutputs) {
+    return (numberOfInputs + 1) * numberOfOutputs;
+  }
+  // Random weights in [-1, 1] followed by zero biases
+  static void appendInitialValues(std::vector<double>& values, size_t numberOfInputs, size_t numberOfOutputs) {
+    std::random_device rd{};
+    std::mt19937 twister(rd());
+    std::generate_n(std::back_inserter(values), numberOfInputs * numberOfOutputs, [&]() {
+      return std::uniform_real_distribution<double>(-1.0, 1.0)(twister);
+    });
+    values.insert(values.end(), numberOfOutputs, 0.0);
+  }
+
+  // Uses the parameterCount(...) values at 'offset' within 'storage'
+  BasicLayer(std::shared_ptr<const std::vector<V>> storage, size_t offset, size_t numberOfInputs, size_t numberOfOutputs)
+  : _storage(std::move(storage)), _offset(offset), _numberOfInputs(numberOfInputs), _numberOfOutputs(numberOfOutputs)
+  {
+    if (_offset + parameterCount(numberOfInputs, numberOfOutputs) > _storage->size()) {
+      throw std::runtime_error("Layer parameters exceed the storage");
+    }
+  }
+  // Standalone layer owning its parameters
+  BasicLayer(size_t numberOfInputs, size_t numberOfOutputs)
+  : BasicLayer(makeStorage(numberOfInputs, numberOfOutputs), 0, numberOfInputs, numberOfOutputs)
   {}
 
-  auto operator()(const std::vector<ValuePtr>& input) {
-    std::vector<ValuePtr> result;
-    for (auto& n : _neurons) {
-      result.push_back(n(input));
+  auto operator()(const std::vector<V>& input) const {
+    std::vector<V> result;
+    for (size_t i = 0; i<_numberOfOutputs; ++i) {
+      result.push_back(neuron(i)(input));
     }
     return result;
   }
 
-  auto parameters() {
-    std::vector<Value*> params;
-    for (auto& n : _neurons) {
-      auto neuronParams = n.parameters();
-      params.insert(params.end(), neuronParams.begin(), neuronParams.end());
+  BasicNeuron<V> neuron(size_t i) const {
+    return { weights().subspan(i * _numberOfInputs, _numberOfInputs), biases()[i] };
+  }
+
+  // Inference only evaluation: plain arithmetic on the parameter values, nothing is recorded
+  // 'output' must hold numberOfOutputs() elements
+  void infer(std::span<const double> input, std::span<double> output) const {
+    if (input.size() != _numberOfInputs || output.size() != _numberOfOutputs) {
+      throw std::runtime_error("Layer input/output size mismatch");
+    }
+    const auto w = weights();
+    const auto b = biases();
+    for (size_t o = 0; o<_numberOfOutputs; ++o) {
+      const auto row = w.subspan(o * _numberOfInputs, _numberOfInputs);
+      double sum = double(b[o]->_value);
+      for (size_t i = 0; i<_numberOfInputs; ++i) {
+        sum += input[i] * double(row[i]->_value);
+      }
+      output[o] = sum;
+    }
+  }
+
+  size_t numberOfInputs() const { return _numberOfInputs; }
+  size_t numberOfOutputs() const { return _numberOfOutputs; }
+  // [X, N] row-major
+  std::span<const V> weights() const { return parameters().first(_numberOfInputs * _numberOfOutputs); }
+  std::span<const V> biases() const { return parameters().last(_numberOfOutputs); }
+  std::span<const V> parameters() const {
+    return { _storage->data() + _offset, parameterCount(_numberOfInputs, _numberOfOutputs) };
+  }
+private:
+  static std::shared_ptr<const std::vector<V>> makeStorage(size_t numberOfInputs, size_t numberOfOutputs) {
+    std::vector<double> values;
+    appendInitialValues(values, numberOfInputs, numberOfOutputs);
+    return std::make_shared<const std::vector<V>>(Traits::makeParameters(values));
+  }
+};
+
+// Result of a checkpointed forward pass (see BasicMultilayerPerceptron::checkpointed)
+// Only the activations at layer boundaries are kept, as leaf values without any graph behind them.
+// Once the gradients of outputs() are known (e.g. after backwards() on a loss computed from them),
+// backwards() walks the layers in reverse: each layer's graph is rebuilt from its input boundary,
+// backpropagated, and released again, so at most one layer's interior is alive at a time.
+template<typename V>
+class BasicCheckpointedForward {
+  using Traits = ValueTraits<V>;
+
+  const std::vector<BasicLayer<V>>* _layers;
+  // _boundaries[0] is the input, _boundaries[i+1] the output of layer i
+  std::vector<std::vector<V>> _boundaries;
+public:
+  BasicCheckpointedForward(const std::vector<BasicLayer<V>>& layers, std::vector<V> input)
+  : _layers(&layers)
+  {
+    _boundaries.push_back(std::move(input));
+    std::vector<double> current;
+    for (auto& v : _boundaries.back()) {
+      current.push_back(double(v->_value));
+    }
+    std::vector<double> next;
+    for (auto& l : layers) {
+      next.resize(l.numberOfOutputs());
+      l.infer(current, next);
+      std::vector<V> boundary;
+      for (auto d : next) {
+        boundary.push_back(Traits::make(d));
+      }
+      _boundaries.push_back(std::move(boundary));
+      std::swap(current, next);
+    }
+  }
+
+  const std::vector<V>& outputs() const { return _boundaries.back(); }
+
+  // Propagates the gradients of outputs() back to the parameters and the input
+  void backwards() {
+    for (size_t i=_layers->size(); i-- > 0;) {
+      const auto& outputGrads = _boundaries[i + 1];
+      auto outputs = (*_layers)[i](_boundaries[i]);
+      // sum(output * upstream gradient) has the recomputed outputs' gradients as its own
+      auto surrogate = Traits::make(0.0);
+      for (size_t j=0; j<outputs.size(); ++j) {
+        surrogate = multiplyAdd(outputs[j], Traits::make(double(outputGrads[j]->_grad)), surrogate);
+      }
+      surrogate->backwards();
     }
-    return params;
   }
 };
 
@@ -72,24 +175,214 @@ public:
 // Feeds input through the next layer
 // and the output to next consecutive layer
 // until it reaches the end
-class MultilayerPerceptron {
-  std::vector<Layer> _layers;
+// Every layer's parameters are created as one contiguous block, in layer order
+template<typename V>
+class BasicMultilayerPerceptron {
+  using Traits = ValueTraits<V>;
+
+  std::shared_ptr<const std::vector<V>> _parameters;
+  std::vector<BasicLayer<V>> _layers;
+
+  static auto makeParameters(const std::vector<size_t>& neuronsPerLayer) {
+    std::vector<double> values;
+    for (size_t i = 0; i<neuronsPerLayer.size()-1; ++i) {
+      BasicLayer<V>::appendInitialValues(values, neuronsPerLayer[i], neuronsPerLayer[i+1]);
+    }
+    return std::make_shared<const std::vector<V>>(Traits::makeParameters(values));
+  }
 public:
-  MultilayerPerceptron(const std::vector<size_t>& neuronsPerLayer) {
+  BasicMultilayerPerceptron(const std::vector<size_t>& neuronsPerLayer) : _parameters(makeParameters(neuronsPerLayer)) {
+    size_t offset = 0;
     for (size_t i = 0; i<neuronsPerLayer.size()-1; ++i) {
-      _layers.push_back(Layer(neuronsPerLayer[i], neuronsPerLayer[i+1]));
+      _layers.push_back(BasicLayer<V>(_parameters, offset, neuronsPerLayer[i], neuronsPerLayer[i+1]));
+      offset += BasicLayer<V>::parameterCount(neuronsPerLayer[i], neuronsPerLayer[i+1]);
     }
   }
 
-  auto operator()(std::vector<ValuePtr> input) {
+  auto operator()(std::vector<V> input) const {
+    for (size_t i=0; i<_layers.size(); ++i) {
+      profiler::Scope scope(profiler::Phase::LayerForward, i);
+      input = _layers[i](input);
+    }
+    return input;
+  }
+
+  // Gradient checkpointing: memory for depth x width activations instead of the whole graph
+  // The layers are evaluated without recording a graph and recomputed during backwards(), roughly
+  // doubling the forward work (see BasicCheckpointedForward)
+  // Note: pointless on the tape engine, which retains every value recorded onto it anyway
+  BasicCheckpointedForward<V> checkpointed(std::vector<V> input) const {
+    return BasicCheckpointedForward<V>(_layers, std::move(input));
+  }
+
+  // Scratch space for infer(), alternating between layers
+  struct InferenceBuffers {
+    std::vector<double> current;
+    std::vector<double> next;
+  };
+
+  // Inference only forward pass which does not build a graph: no nodes are created and
+  // the intermediate activations live in 'buffers', so once they have grown to the widest
+  // layer, repeated calls do not allocate
+  // The result views 'buffers' and is valid until they are next used
+  std::span<const double> infer(std::span<const double> input, InferenceBuffers& buffers) const {
+    buffers.current.assign(input.begin(), input.end());
     for (auto& l : _layers) {
-      input = l(input);
+      buffers.next.resize(l.numberOfOutputs());
+      l.infer(buffers.current, buffers.next);
+      std::swap(buffers.current, buffers.next);
+    }
+    return buffers.current;
+  }
+  // Uses buffers private to the calling thread, the result is valid until its next infer() call
+  std::span<const double> infer(std::span<const double> input) const {
+    thread_local InferenceBuffers buffers;
+    return infer(input, buffers);
+  }
+
+  const std::vector<BasicLayer<V>>& layers() const { return _layers; }
+  std::span<const V> parameters() const { return *_parameters; }
+};
+
+using Neuron = BasicNeuron<ValuePtr>;
+using Layer = BasicLayer<ValuePtr>;
+using MultilayerPerceptron = BasicMultilayerPerceptron<ValuePtr>;
+
+// Tensor based counterpart of Layer: N inputs -> X outputs
+// The neurons' weights are held as a single [N, X] matrix plus a [1, X] bias,
+// so evaluating the layer is one matmul, one bias addition and (optionally) one RELU
+// on whole tensors, rather than a graph of 2N scalar nodes per neuron
+// Both are views into a ParameterBuffer (weights first, then bias) so that an optimizer
+// can update every parameter of a model in one linear pass
+class TensorLayer {
+  TensorValuePtr _weights;
+  TensorValuePtr _bias;
+  bool _relu;
+
+  static auto parameter(const ParameterBuffer& buffer, size_t offset, std::vector<size_t> shape) {
+    auto result = TensorValue::make(buffer.valueView(offset, shape));
+    result->_grad = buffer.gradView(offset, std::move(shape));
+    return result;
+  }
+  static void generateWeights(std::span<double> weights) {
+    std::random_device rd{};
+    std::mt19937 twister(rd());
+    std::generate(weights.begin(), weights.end(), [&]() {
+      return std::uniform_real_distribution<double>(-1.0, 1.0)(twister);
+    });
+  }
+  static ParameterBuffer initialized(size_t numberOfInputs, size_t numberOfOutputs) {
+    ParameterBuffer buffer(parameterCount(numberOfInputs, numberOfOutputs));
+    initialize(buffer, 0, numberOfInputs, numberOfOutputs);
+    return buffer;
+  }
+public:
+  static size_t parameterCount(size_t numberOfInputs, size_t numberOfOutputs) {
+    return (numberOfInputs + 1) * numberOfOutputs;
+  }
+
+  // Random weights and zero biases for the layer at 'offset' within 'buffer'
+  static void initialize(ParameterBuffer& buffer, size_t offset, size_t numberOfInputs, size_t numberOfOutputs) {
+    generateWeights(buffer.values().subspan(offset, numberOfInputs * numberOfOutputs));
+    const auto biases = buffer.values().subspan(offset + numberOfInputs * numberOfOutputs, numberOfOutputs);
+    std::fill(biases.begin(), biases.end(), 0.0);
+  }
+
+  // Uses the (already initialized) parameters at 'offset' within 'buffer'
+  TensorLayer(const ParameterBuffer& buffer, size_t offset, size_t numberOfInputs, size_t numberOfOutputs, bool relu = true)
+  : _weights(parameter(buffer, offset, { numberOfInputs, numberOfOutputs })),
+  _bias(parameter(buffer, offset + numberOfInputs * numberOfOutputs, { 1, numberOfOutputs })),
+  _relu(relu)
+  {}
+  // Standalone layer owning its parameters
+  TensorLayer(size_t numberOfInputs, size_t numberOfOutputs, bool relu = true)
+  : TensorLayer(initialized(numberOfInputs, numberOfOutputs), 0, numberOfInputs, numberOfOutputs, relu)
+  {}
+
+  // [B, N] input -> [B, X] output, the bias is broadcast over the B rows
+  TensorValuePtr operator()(const TensorValuePtr& input) {
+    auto result = matmul(input, _weights) + _bias;
+    return _relu ? relu(result) : result;
+  }
+
+  auto parameters() {
+    return std::vector<TensorValue*>{ _weights.get(), _bias.get() };
+  }
+};
+
+// Tensor based counterpart of MultilayerPerceptron
+// Hidden layers apply a RELU, the output layer is linear
+class TensorMultilayerPerceptron {
+  std::vector<size_t> _neuronsPerLayer;
+  ParameterBuffer _parameters;
+  std::vector<TensorLayer> _layers;
+
+  static size_t parameterCount(const std::vector<size_t>& neuronsPerLayer) {
+    size_t count = 0;
+    for (size_t i = 0; i<neuronsPerLayer.size()-1; ++i) {
+      count += TensorLayer::parameterCount(neuronsPerLayer[i], neuronsPerLayer[i+1]);
+    }
+    return count;
+  }
+  static ParameterBuffer initialized(const std::vector<size_t>& neuronsPerLayer) {
+    ParameterBuffer buffer(parameterCount(neuronsPerLayer));
+    size_t offset = 0;
+    for (size_t i = 0; i<neuronsPerLayer.size()-1; ++i) {
+      TensorLayer::initialize(buffer, offset, neuronsPerLayer[i], neuronsPerLayer[i+1]);
+      offset += TensorLayer::parameterCount(neuronsPerLayer[i], neuronsPerLayer[i+1]);
+    }
+    return buffer;
+  }
+public:
+  // Builds the layers over 'parameters', which must already be initialized
+  TensorMultilayerPerceptron(const std::vector<size_t>& neuronsPerLayer, ParameterBuffer parameters)
+  : _neuronsPerLayer(neuronsPerLayer), _parameters(std::move(parameters)) {
+    if (_parameters.size() != parameterCount(neuronsPerLayer)) {
+      throw std::runtime_error("Parameter buffer size does not match the layers");
+    }
+    size_t offset = 0;
+    for (size_t i = 0; i<neuronsPerLayer.size()-1; ++i) {
+      _layers.push_back(TensorLayer(_parameters, offset, neuronsPerLayer[i], neuronsPerLayer[i+1], i+2 < neuronsPerLayer.size()));
+      offset += TensorLayer::parameterCount(neuronsPerLayer[i], neuronsPerLayer[i+1]);
+    }
+  }
+  TensorMultilayerPerceptron(const std::vector<size_t>& neuronsPerLayer)
+  : TensorMultilayerPerceptron(neuronsPerLayer, initialized(neuronsPerLayer))
+  {}
+
+  // Model sharing this one's parameter values, but accumulating gradients into its own buffer
+  TensorMultilayerPerceptron replica() const {
+    return TensorMultilayerPerceptron(_neuronsPerLayer, _parameters.withOwnGradients());
+  }
+  const std::vector<size_t>& neuronsPerLayer() const { return _neuronsPerLayer; }
+
+  // Every weight and bias of the model, laid out contiguously layer by layer
+  ParameterBuffer& parameterBuffer() { return _parameters; }
+  const ParameterBuffer& parameterBuffer() const { return _parameters; }
+
+  TensorValuePtr operator()(TensorValuePtr input) {
+    for (size_t i=0; i<_layers.size(); ++i) {
+      profiler::Scope scope(profiler::Phase::LayerForward, i);
+      input = _layers[i](input);
     }
     return input;
   }
 
+  // Mini-batch forward pass: [batch, inputs] -> [batch, outputs], each row being one sample
+  TensorValuePtr operator()(const Tensor& batch) {
+    return (*this)(TensorValue::make(batch));
+  }
+
+  // One forward/backward pass over the whole batch, returning the mean squared error
+  // Note: gradients are accumulated, call zeroGrad() on the parameters between steps
+  double backwards(const Tensor& batch, const Tensor& targets) {
+    auto loss = meanSquaredError((*this)(batch), TensorValue::make(targets));
+    loss->backwards();
+    return loss->_value.element();
+  }
+
   auto parameters() {
-    std::vector<Value*> params;
+    std::vector<TensorValue*> params;
     for (auto& l : _layers) {
       auto layerParams = l.parameters();
       params.insert(params.end(), layerParams.begin(), layerParams.end());
@@ -0,0 +1,172 @@
+#pragma once
+
+#include "profiler.hpp"
+#include "tensor.hpp"
+#include "thread_pool.hpp"
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+// Flat contiguous storage for a model's parameters and their gradients
+// Models carve their parameter tensors out of it as views (see valueView/gradView),
+// so an optimizer step is a linear sweep over two arrays rather than a walk over
+// individually allocated parameters.
+// Copies of a buffer are handles sharing the same storage.
+class ParameterBuffer {
+  size_t _size;
+  std::shared_ptr<double[]> _values;
+  std::shared_ptr<double[]> _grads;
+public:
+  ParameterBuffer(size_t size = 0)
+  : _size(size),
+  _values(std::make_shared<double[]>(size)),
+  _grads(std::make_shared<double[]>(size))
+  {}
+  // Parameters stored in 'values' (e.g. a memory mapped checkpoint), with zeroed gradients
+  ParameterBuffer(std::shared_ptr<double[]> values, size_t size)
+  : _size(size),
+  _values(std::move(values)),
+  _grads(std::make_shared<double[]>(size))
+  {}
+
+  // Buffer sharing these parameter values, with its own (zeroed) gradients
+  // e.g. for replicas of a model accumulating gradients independently
+  ParameterBuffer withOwnGradients() const {
+    auto result = *this;
+    result._grads = std::make_shared<double[]>(_size);
+    return result;
+  }
+
+  size_t size() const { return _size; }
+  std::span<double> values() { return { _values.get(), _size }; }
+  std::span<double> grads() { return { _grads.get(), _size }; }
+
+  // Row-major views of the elements [offset, offset + size of 'shape')
+  Tensor valueView(size_t offset, std::vector<size_t> shape) const { return view(_values, offset, std::move(shape)); }
+  Tensor gradView(size_t offset, std::vector<size_t> shape) const { return view(_grads, offset, std::move(shape)); }
+private:
+  Tensor view(const std::shared_ptr<double[]>& storage, size_t offset, std::vector<size_t> shape) const {
+    size_t size = 1;
+    for (auto s : shape) {
+      size *= s;
+    }
+    if (offset + size > _size) {
+      throw std::runtime_error("Parameter view exceeds the buffer");
+    }
+    return Tensor::fromStorage(storage, offset, std::move(shape));
+  }
+};
+
+namespace optim {
+
+// Large parameter sets are updated in blocks of this many elements across the global thread pool
+constexpr size_t ParallelBlock = size_t(1) << 14;
+
+// Each optimizer applies its update and zeroes the gradient in the same pass, so no
+// separate zero-grad sweep is needed before the next backwards(). The per-element loops
+// only use plain arithmetic on restrict-qualified pointers captured by value so that
+// they auto-vectorize (the Adam square root needs -fno-math-errno, implied by -Ofast).
+template<typename Func>
+void forBlocks(size_t size, Func&& fn) {
+  if (size <= ParallelBlock) {
+    fn(0, size);
+  } else {
+    ThreadPool::global().parallelFor(0, size, ParallelBlock, fn);
+  }
+}
+
+void checkSizes(std::span<double> values, std::span<double> grads, std::vector<double>& state) {
+  if (values.size() != grads.size()) {
+    throw std::runtime_error("Parameter and gradient sizes do not match");
+  }
+  if (state.size() != values.size()) {
+    state.assign(values.size(), 0.0);
+  }
+}
+
+}
+
+// Stochastic gradient descent with (optional) momentum:
+// v = momentum * v + g, p -= learningRate * v
+class SGD {
+  double _learningRate;
+  double _momentum;
+  std::vector<double> _velocity;
+public:
+  SGD(double learningRate, double momentum = 0.0) : _learningRate(learningRate), _momentum(momentum)
+  {}
+
+  void step(std::span<double> values, std::span<double> grads) {
+    profiler::Scope scope(profiler::Phase::OptimizerStep);
+    optim::checkSizes(values, grads, _velocity);
+    const auto lr = _learningRate;
+    const auto momentum = _momentum;
+    double* __restrict p = values.data();
+    double* __restrict g = grads.data();
+    double* __restrict v = _velocity.data();
+    optim::forBlocks(values.size(), [=](size_t begin, size_t end) {
+      for (size_t i=begin; i<end; ++i) {
+        v[i] = momentum * v[i] + g[i];
+        p[i] -= lr * v[i];
+        g[i] = 0.0;
+      }
+    });
+  }
+  void step(ParameterBuffer& buffer) { step(buffer.values(), buffer.grads()); }
+};
+
+// Adam (Kingma & Ba) with bias corrected first and second moment estimates
+// A non-zero weightDecay is applied decoupled from the gradient (see AdamW)
+class Adam {
+  double _learningRate;
+  double _beta1;
+  double _beta2;
+  double _epsilon;
+  double _weightDecay;
+  size_t _steps = 0;
+  std::vector<double> _m;
+  std::vector<double> _v;
+public:
+  Adam(double learningRate = 0.001, double beta1 = 0.9, double beta2 = 0.999, double epsilon = 1e-8, double weightDecay = 0.0)
+  : _learningRate(learningRate), _beta1(beta1), _beta2(beta2), _epsilon(epsilon), _weightDecay(weightDecay)
+  {}
+
+  void step(std::span<double> values, std::span<double> grads) {
+    profiler::Scope scope(profiler::Phase::OptimizerStep);
+    optim::checkSizes(values, grads, _m);
+    optim::checkSizes(values, grads, _v);
+    ++_steps;
+    // Bias corrections are folded into the step size and epsilon once per step
+    const auto correction1 = 1.0 - std::pow(_beta1, double(_steps));
+    const auto correction2 = std::sqrt(1.0 - std::pow(_beta2, double(_steps)));
+    const auto stepSize = _learningRate * correction2 / correction1;
+    const auto epsilon = _epsilon * correction2;
+    const auto decay = 1.0 - _learningRate * _weightDecay;
+    const auto beta1 = _beta1;
+    const auto beta2 = _beta2;
+    double* __restrict p = values.data();
+    double* __restrict g = grads.data();
+    double* __restrict m = _m.data();
+    double* __restrict v = _v.data();
+    optim::forBlocks(values.size(), [=](size_t begin, size_t end) {
+      for (size_t i=begin; i<end; ++i) {
+        m[i] = beta1 * m[i] + (1.0 - beta1) * g[i];
+        v[i] = beta2 * v[i] + (1.0 - beta2) * g[i] * g[i];
+        p[i] = p[i] * decay - stepSize * m[i] / (std::sqrt(v[i]) + epsilon);
+        g[i] = 0.0;
+      }
+    });
+  }
+  void step(ParameterBuffer& buffer) { step(buffer.values(), buffer.grads()); }
+};
+
+// Adam with decoupled weight decay (Loshchilov & Hutter)
+class AdamW : public Adam {
+public:
+  AdamW(double learningRate = 0.001, double weightDecay = 0.01, double beta1 = 0.9, double beta2 = 0.999, double epsilon = 1e-8)
+  : Adam(learningRate, beta1, beta2, epsilon, weightDecay)
+  {}
+};
\ No newline at end of file
@@ -0,0 +1,268 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// Opt-in instrumentation of graph building, backpropagation and training:
+// - nodes created per Operation and the bytes of node storage they take
+// - time spent sorting graphs topologically, backpropagating and updating parameters
+// - time per layer of the MultilayerPerceptron forward passes
+// Compiled in with VERYSMALLGRAD_PROFILE defined (the CMake option of the same name).
+// Otherwise the hooks have empty bodies and a Scope holds no state,
+// so instrumented code compiles to what it was without them.
+//
+// Each thread records into its own stats, which stats() sums. While tracing is on,
+// every timed scope is also kept as an event for writeChromeTrace (chrome://tracing, Perfetto).
+namespace profiler {
+
+#ifdef VERYSMALLGRAD_PROFILE
+constexpr bool Enabled = true;
+#else
+constexpr bool Enabled = false;
+#endif
+
+// Upper bound of the Operation values counted by nodesCreated
+constexpr size_t MaxOperations = 16;
+
+enum class Phase : uint8_t {
+  TopoSort,
+  Backward,
+  LayerForward,
+  OptimizerStep
+};
+
+const char* toString(Phase phase)
+{
+  switch (phase) {
+    case Phase::TopoSort: return "topo sort";
+    case Phase::Backward: return "backward";
+    case Phase::LayerForward: return "layer forward";
+    case Phase::OptimizerStep: return "optimizer step";
+  }
+  return "unknown";
+}
+
+struct Timing {
+  size_t count = 0;
+  double seconds = 0.0;
+
+  Timing& operator+=(const Timing& other) {
+    count += other.count;
+    seconds += other.seconds;
+    return *this;
+  }
+};
+
+struct Stats {
+  // Indexed by Operation (see engine.hpp)
+  std::array<size_t, MaxOperations> nodesCreated{};
+  size_t bytesAllocated = 0;
+  Timing topoSort;
+  Timing backward;
+  Timing optimizerStep;
+  // Indexed by layer
+  std::vector<Timing> layerForward;
+
+  size_t totalNodes() const {
+    size_t total = 0;
+    for (auto n : nodesCreated) {
+      total += n;
+    }
+    return total;
+  }
+
+  Stats& operator+=(const Stats& other) {
+    for (size_t i=0; i<MaxOperations; ++i) {
+      nodesCreated[i] += other.nodesCreated[i];
+    }
+    bytesAllocated += other.bytesAllocated;
+    topoSort += other.topoSort;
+    backward += other.backward;
+    optimizerStep += other.optimizerStep;
+    if (layerForward.size() < other.layerForward.size()) {
+      layerForward.resize(other.layerForward.size());
+    }
+    for (size_t i=0; i<other.layerForward.size(); ++i) {
+      layerForward[i] += other.layerForward[i];
+    }
+    return *this;
+  }
+};
+
+namespace detail {
+
+using Clock = std::chrono::steady_clock;
+
+struct Event {
+  Phase phase;
+  size_t index;
+  Clock::time_point start;
+  Clock::duration duration;
+};
+
+struct ThreadData {
+  size_t id;
+  // Only contended while stats are collected from another thread
+  std::mutex mutex;
+  Stats stats;
+  std::vector<Event> events;
+};
+
+struct Registry {
+  std::mutex mutex;
+  // Kept beyond the lifetime of their threads so their stats still count
+  std::vector<std::shared_ptr<ThreadData>> threads;
+  Clock::time_point origin = Clock::now();
+  std::atomic<bool> tracing{false};
+};
+
+Registry& registry()
+{
+  static Registry instance;
+  return instance;
+}
+
+ThreadData& local()
+{
+  thread_local const auto data = []() {
+    auto& r = registry();
+    std::lock_guard lock(r.mutex);
+    auto result = std::make_shared<ThreadData>();
+    result->id = r.threads.size();
+    r.threads.push_back(result);
+    return result;
+  }();
+  return *data;
+}
+
+void record(Phase phase, size_t index, Clock::time_point start, Clock::duration duration)
+{
+  auto& data = local();
+  std::lock_guard lock(data.mutex);
+  auto& stats = data.stats;
+  const Timing timing{ 1, std::chrono::duration<double>(duration).count() };
+  switch (phase) {
+    case Phase::TopoSort: stats.topoSort += timing; break;
+    case Phase::Backward: stats.backward += timing; break;
+    case Phase::OptimizerStep: stats.optimizerStep += timing; break;
+    case Phase::LayerForward:
+      if (stats.layerForward.size() <= index) {
+        stats.layerForward.resize(index + 1);
+      }
+      stats.layerForward[index] += timing;
+      break;
+  }
+  if (registry().tracing.load(std::memory_order_relaxed)) {
+    data.events.push_back({ phase, index, start, duration });
+  }
+}
+
+}
+
+// Called for every node constructed
+void countNode([[maybe_unused]] size_t operation, [[maybe_unused]] size_t bytes)
+{
+  if constexpr (Enabled) {
+    auto& data = detail::local();
+    std::lock_guard lock(data.mutex);
+    ++data.stats.nodesCreated[operation];
+    data.stats.bytesAllocated += bytes;
+  }
+}
+
+// Times its lifetime as the given phase ('index' being the layer of LayerForward)
+class Scope {
+#ifdef VERYSMALLGRAD_PROFILE
+  Phase _phase;
+  size_t _index;
+  detail::Clock::time_point _start;
+public:
+  Scope(Phase phase, size_t index = 0)
+  : _phase(phase), _index(index), _start(detail::Clock::now())
+  {}
+  ~Scope() {
+    detail::record(_phase, _index, _start, detail::Clock::now() - _start);
+  }
+#else
+public:
+  Scope(Phase, size_t = 0)
+  {}
+#endif
+  Scope(const Scope&) = delete;
+  Scope& operator=(const Scope&) = delete;
+};
+
+// Totals over all threads since the last reset()
+Stats stats()
+{
+  Stats total;
+  if constexpr (Enabled) {
+    auto& r = detail::registry();
+    std::lock_guard lock(r.mutex);
+    for (auto& thread : r.threads) {
+      std::lock_guard threadLock(thread->mutex);
+      total += thread->stats;
+    }
+  }
+  return total;
+}
+
+// Clears the stats and trace events of all threads
+void reset()
+{
+  if constexpr (Enabled) {
+    auto& r = detail::registry();
+    std::lock_guard lock(r.mutex);
+    for (auto& thread : r.threads) {
+      std::lock_guard threadLock(thread->mutex);
+      thread->stats = {};
+      thread->events.clear();
+    }
+  }
+}
+
+// Keeps an event per timed scope from now on (off by default, as events grow without bound)
+void setTracing(bool enabled)
+{
+  detail::registry().tracing = enabled;
+}
+
+// Chrome trace event format: one complete ('X') event per recorded scope
+void writeChromeTrace(std::ostream& out)
+{
+  const auto flags = out.flags();
+  const auto precision = out.precision();
+  out << "{\"traceEvents\":[" << std::fixed << std::setprecision(3);
+  if constexpr (Enabled) {
+    auto& r = detail::registry();
+    std::lock_guard lock(r.mutex);
+    bool first = true;
+    for (auto& thread : r.threads) {
+      std::lock_guard threadLock(thread->mutex);
+      for (const auto& e : thread->events) {
+        const auto start = std::chrono::duration<double, std::micro>(e.start - r.origin).count();
+        const auto duration = std::chrono::duration<double, std::micro>(e.duration).count();
+        out << (first ? "" : ",") << "\n{\"name\":\"" << toString(e.phase) << "\",\"cat\":\"verysmallgrad\",\"ph\":\"X\""
+          << ",\"ts\":" << start << ",\"dur\":" << duration << ",\"pid\":0,\"tid\":" << thread->id;
+        if (e.phase == Phase::LayerForward) {
+          out << ",\"args\":{\"layer\":" << e.index << "}";
+        }
+        out << "}";
+        first = false;
+      }
+    }
+  }
+  out << "\n]}\n";
+  out.flags(flags);
+  out.precision(precision);
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,269 @@
+#pragma once
+
+#include "matmul.hpp"
+#include "nn.hpp"
+#include "tensor.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+// Post-training int8 quantization for inference
+// Values are quantized symmetrically: q = round(x / scale) in [-127, 127] with scale = max|x| / 127,
+// over the whole matrix or per column (output channel). Activations are quantized on the fly,
+// one scale per row (sample), so the int32 accumulated product dequantizes as
+// acc[i][j] * rowScale[i] * columnScale[j].
+// Weights take a byte each instead of the 8 of a double; products go through the packed GEMM
+// kernels with int32 accumulation.
+namespace quant {
+
+enum class Granularity {
+  PerTensor,
+  PerChannel
+};
+
+// Row-major [rows, columns] int8 matrix with one scale per column (all equal when PerTensor)
+struct QuantizedMatrix {
+  size_t rows = 0;
+  size_t columns = 0;
+  std::vector<int8_t> values;
+  std::vector<double> scales;
+
+  size_t bytes() const { return values.size() * sizeof(int8_t) + scales.size() * sizeof(double); }
+};
+
+constexpr int Levels = 127;
+// Longest inner dimension an int32 product accumulates exactly: k * 127 * 127 < 2^31
+constexpr size_t MaxDepth = size_t(1) << 17;
+
+double scaleFor(double maxAbs)
+{
+  // An all zero range quantizes to zeros with any scale
+  return maxAbs > 0.0 ? maxAbs / Levels : 1.0;
+}
+
+int8_t quantize(double x, double scale)
+{
+  return int8_t(std::clamp<long>(std::lround(x / scale), -Levels, Levels));
+}
+
+QuantizedMatrix quantizeColumns(const Tensor& matrix, Granularity granularity = Granularity::PerChannel)
+{
+  if (matrix.shape().size() != 2) {
+    throw std::runtime_error("Only matrices can be quantized");
+  }
+  const auto source = matrix.contiguous();
+  const auto data = source.data();
+  QuantizedMatrix result{ matrix.shape()[0], matrix.shape()[1], {}, {} };
+  std::vector<double> maxAbs(result.columns, 0.0);
+  for (size_t i=0; i<result.rows; ++i) {
+    for (size_t j=0; j<result.columns; ++j) {
+      maxAbs[j] = std::max(maxAbs[j], std::abs(data[i * result.columns + j]));
+    }
+  }
+  if (granularity == Granularity::PerTensor) {
+    std::fill(maxAbs.begin(), maxAbs.end(), maxAbs.empty() ? 0.0 : *std::max_element(maxAbs.begin(), maxAbs.end()));
+  }
+  for (auto m : maxAbs) {
+    result.scales.push_back(scaleFor(m));
+  }
+  result.values.resize(data.size());
+  for (size_t i=0; i<result.rows; ++i) {
+    for (size_t j=0; j<result.columns; ++j) {
+      result.values[i * result.columns + j] = quantize(data[i * result.columns + j], result.scales[j]);
+    }
+  }
+  return result;
+}
+
+// Values of the quantized matrix as doubles
+Tensor dequantize(const QuantizedMatrix& matrix)
+{
+  return Tensor::generate({ matrix.rows, matrix.columns }, [&](size_t index) {
+    return matrix.values[index] * matrix.scales[index % matrix.columns];
+  });
+}
+
+// a [m, k] * b [k, n] -> [m, n], with 'a' quantized per row for the int8 product
+Tensor matmul(const Tensor& a, const QuantizedMatrix& b)
+{
+  if (a.shape().size() != 2 || a.shape()[1] != b.rows) {
+    throw std::runtime_error("Matrix shapes do not match for multiplication");
+  }
+  const auto source = a.contiguous();
+  const auto data = source.data();
+  const auto m = a.shape()[0];
+  const auto k = b.rows;
+  const auto n = b.columns;
+  std::vector<int8_t> quantized(m * k);
+  std::vector<double> rowScales(m);
+  for (size_t i=0; i<m; ++i) {
+    const auto row = data.subspan(i * k, k);
+    double maxAbs = 0.0;
+    for (auto x : row) {
+      maxAbs = std::max(maxAbs, std::abs(x));
+    }
+    rowScales[i] = scaleFor(maxAbs);
+    for (size_t p=0; p<k; ++p) {
+      quantized[i * k + p] = quantize(row[p], rowScales[i]);
+    }
+  }
+  // Summed in int64 over blocks of MaxDepth along k, each exact in int32
+  std::vector<int64_t> total(m * n, 0);
+  std::vector<int32_t> acc(m * n);
+  for (size_t p=0; p<k; p+=MaxDepth) {
+    std::fill(acc.begin(), acc.end(), 0);
+    kernels::gemmParallel<int8_t, int32_t>(ThreadPool::global(), m, n, std::min(MaxDepth, k - p), quantized.data() + p, k, 1, b.values.data() + p * n, n, 1, acc.data(), n);
+    std::transform(total.begin(), total.end(), acc.begin(), total.begin(), std::plus<>());
+  }
+  return Tensor::generate({ m, n }, [&](size_t index) {
+    return double(total[index]) * rowScales[index / n] * b.scales[index % n];
+  });
+}
+
+struct QuantizedLayer {
+  // [inputs, outputs]
+  QuantizedMatrix weights;
+  // [1, outputs], kept in double: a handful of values, added after dequantization
+  Tensor biases;
+  bool relu = false;
+};
+
+}
+
+// int8 copy of a trained MultilayerPerceptron (or TensorMultilayerPerceptron) for inference
+class QuantizedMultilayerPerceptron {
+  std::vector<quant::QuantizedLayer> _layers;
+
+  void add(const Tensor& weights, const Tensor& biases, bool relu, quant::Granularity granularity) {
+    _layers.push_back({ quant::quantizeColumns(weights, granularity), biases.clone().view({ 1, biases.size() }), relu });
+  }
+public:
+  // Linear layers, as MultilayerPerceptron evaluates them
+  explicit QuantizedMultilayerPerceptron(const MultilayerPerceptron& model, quant::Granularity granularity = quant::Granularity::PerChannel) {
+    for (const auto& l : model.layers()) {
+      const auto in = l.numberOfInputs();
+      const auto out = l.numberOfOutputs();
+      const auto w = l.weights();
+      // BasicLayer rows are per output (neuron), transposed to [inputs, outputs]
+      const auto weights = Tensor::generate({ in, out }, [&](size_t index) { return double(w[(index % out) * in + index / out]->_value); });
+      const auto b = l.biases();
+      const auto biases = Tensor::generate({ out }, [&](size_t index) { return double(b[index]->_value); });
+      add(weights, biases, false, granularity);
+    }
+  }
+  // ReLU on all but the last layer, as TensorMultilayerPerceptron evaluates them
+  explicit QuantizedMultilayerPerceptron(const TensorMultilayerPerceptron& model, quant::Granularity granularity = quant::Granularity::PerChannel) {
+    const auto& sizes = model.neuronsPerLayer();
+    const auto& buffer = model.parameterBuffer();
+    size_t offset = 0;
+    for (size_t i=0; i+1<sizes.size(); ++i) {
+      const auto weights = buffer.valueView(offset, { sizes[i], sizes[i+1] });
+      offset += sizes[i] * sizes[i+1];
+      const auto bias = buffer.valueView(offset, { sizes[i+1] });
+      offset += sizes[i+1];
+      add(weights, bias, i+2 < sizes.size(), granularity);
+    }
+  }
+
+  const std::vector<quant::QuantizedLayer>& layers() const { return _layers; }
+  size_t numberOfInputs() const { return _layers.front().weights.rows; }
+  size_t numberOfOutputs() const { return _layers.back().weights.columns; }
+
+  // Storage of the quantized weights, scales and biases
+  size_t bytes() const {
+    size_t total = 0;
+    for (const auto& l : _layers) {
+      total += l.weights.bytes() + l.biases.size() * sizeof(double);
+    }
+    return total;
+  }
+
+  // [batch, inputs] -> [batch, outputs]
+  Tensor operator()(const Tensor& batch) const {
+    auto x = batch;
+    for (const auto& l : _layers) {
+      x = quant::matmul(x, l.weights) + l.biases;
+      if (l.relu) {
+        x = x.relu();
+      }
+    }
+    return x;
+  }
+  std::vector<double> infer(std::span<const double> input) const {
+    const auto output = (*this)(Tensor(std::vector<double>(input.begin(), input.end()), { 1, input.size() }));
+    return std::vector<double>(output.data().begin(), output.data().end());
+  }
+};
+
+namespace quant {
+
+// Accuracy of a quantized model against the model it was quantized from, on [samples, inputs]
+struct Report {
+  double maxAbsError = 0.0;
+  double meanAbsError = 0.0;
+  double rmsError = 0.0;
+  // Largest output magnitude of the reference, to put the errors in scale
+  double maxAbsOutput = 0.0;
+  size_t referenceBytes = 0;
+  size_t quantizedBytes = 0;
+};
+
+// Errors of 'actual' against 'expected' (same shape)
+Report measure(const Tensor& actual, const Tensor& expected)
+{
+  if (actual.shape() != expected.shape()) {
+    throw std::runtime_error("Quantized and reference outputs differ in shape");
+  }
+  Report report;
+  const auto a = actual.contiguous();
+  const auto e = expected.contiguous();
+  const auto ad = a.data();
+  const auto ed = e.data();
+  double sumAbs = 0.0;
+  double sumSquares = 0.0;
+  for (size_t i=0; i<ad.size(); ++i) {
+    const auto error = std::abs(ad[i] - ed[i]);
+    report.maxAbsError = std::max(report.maxAbsError, error);
+    report.maxAbsOutput = std::max(report.maxAbsOutput, std::abs(ed[i]));
+    sumAbs += error;
+    sumSquares += error * error;
+  }
+  if (!ad.empty()) {
+    report.meanAbsError = sumAbs / double(ad.size());
+    report.rmsError = std::sqrt(sumSquares / double(ad.size()));
+  }
+  return report;
+}
+
+Report compare(const MultilayerPerceptron& reference, const QuantizedMultilayerPerceptron& quantized, const Tensor& samples)
+{
+  const auto rows = samples.shape().at(0);
+  const auto inputs = quantized.numberOfInputs();
+  const auto source = samples.contiguous();
+  std::vector<double> expected;
+  for (size_t i=0; i<rows; ++i) {
+    const auto output = reference.infer(source.data().subspan(i * inputs, inputs));
+    expected.insert(expected.end(), output.begin(), output.end());
+  }
+  auto report = measure(quantized(samples), Tensor(expected, { rows, quantized.numberOfOutputs() }));
+  report.referenceBytes = reference.parameters().size() * sizeof(double);
+  report.quantizedBytes = quantized.bytes();
+  return report;
+}
+
+Report compare(const TensorMultilayerPerceptron& reference, const QuantizedMultilayerPerceptron& quantized, const Tensor& samples)
+{
+  auto model = reference;
+  auto report = measure(quantized(samples), model(samples)->_value);
+  report.referenceBytes = reference.parameterBuffer().size() * sizeof(double);
+  report.quantizedBytes = quantized.bytes();
+  return report;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+
+// Reduction kernels shared by the Tensor reductions and the losses
+//
+// Sums are pairwise: the range is halved recursively down to leaves of Leaf elements,
+// so the rounding error grows with log(n) instead of n as for a running total.
+// Each leaf is accumulated into Lanes independent partial sums, which breaks the serial
+// dependency of the additions and lets the compiler keep them in one SIMD register
+// (strictly ordered float additions can't otherwise be vectorized without -ffast-math).
+namespace kernels {
+
+constexpr size_t Lanes = 8;
+constexpr size_t Leaf = 128;
+
+// Sum of fn(i) for i in [0, n)
+template<typename C, typename Func>
+C pairwiseSum(size_t n, Func&& fn, size_t first = 0)
+{
+  if (n <= Leaf) {
+    std::array<C, Lanes> partial{};
+    size_t i = 0;
+    for (; i + Lanes <= n; i += Lanes) {
+      for (size_t j=0; j<Lanes; ++j) {
+        partial[j] += C(fn(first + i + j));
+      }
+    }
+    for (size_t j=0; i<n; ++i, ++j) {
+      partial[j] += C(fn(first + i));
+    }
+    for (size_t width=Lanes/2; width>0; width/=2) {
+      for (size_t j=0; j<width; ++j) {
+        partial[j] += partial[j + width];
+      }
+    }
+    return partial[0];
+  }
+  // Split on a multiple of the lane count so the leaves stay fully vectorized
+  const auto half = (n / 2 + Lanes - 1) / Lanes * Lanes;
+  return pairwiseSum<C>(half, fn, first) + pairwiseSum<C>(n - half, fn, first + half);
+}
+
+// Maximum of fn(i) for i in [0, n), n > 0
+template<typename C, typename Func>
+C maximum(size_t n, Func&& fn)
+{
+  std::array<C, Lanes> partial;
+  partial.fill(C(fn(0)));
+  size_t i = 0;
+  for (; i + Lanes <= n; i += Lanes) {
+    for (size_t j=0; j<Lanes; ++j) {
+      partial[j] = std::max(partial[j], C(fn(i + j)));
+    }
+  }
+  for (; i<n; ++i) {
+    partial[0] = std::max(partial[0], C(fn(i)));
+  }
+  return *std::max_element(partial.begin(), partial.end());
+}
+
+// out[j] = sum over r in [0, rows) of fn(r, j), for j in [0, columns)
+// Pairwise over the rows, each step adding whole rows so the loop over columns vectorizes
+// 'columns' must be at most MaxColumns
+constexpr size_t MaxColumns = 64;
+
+template<typename C, typename Func>
+void pairwiseSumRows(size_t rows, size_t columns, C* out, Func&& fn, size_t first = 0)
+{
+  if (rows <= Lanes) {
+    for (size_t j=0; j<columns; ++j) {
+      out[j] = C(0);
+    }
+    for (size_t r=0; r<rows; ++r) {
+      for (size_t j=0; j<columns; ++j) {
+        out[j] += C(fn(first + r, j));
+      }
+    }
+    return;
+  }
+  const auto half = rows / 2;
+  std::array<C, MaxColumns> second;
+  pairwiseSumRows<C>(half, columns, out, fn, first);
+  pairwiseSumRows<C>(rows - half, columns, second.data(), fn, first + half);
+  for (size_t j=0; j<columns; ++j) {
+    out[j] += second[j];
+  }
+}
+
+}
\ No newline at end of file
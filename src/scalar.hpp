@@ -0,0 +1,110 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+
+// Storage-only reduced precision floating point types
+// They only convert to and from float: arithmetic on tensors of these types
+// is carried out (and accumulated) in float, see ComputeType.
+
+// IEEE 754 binary16
+struct float16 {
+  uint16_t bits = 0;
+
+  float16() = default;
+  float16(float value) : bits(fromFloat(value)) {}
+  operator float() const { return toFloat(bits); }
+
+  static uint16_t fromFloat(float value) {
+    const auto x = std::bit_cast<uint32_t>(value);
+    const uint32_t sign = (x >> 16) & 0x8000;
+    const uint32_t exponent = (x >> 23) & 0xff;
+    uint32_t mantissa = x & 0x7fffff;
+    if (exponent == 0xff) {
+      // Infinity or NaN (kept quiet)
+      return uint16_t(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    }
+    int e = int(exponent) - 127 + 15;
+    if (e >= 0x1f) {
+      return uint16_t(sign | 0x7c00);
+    }
+    if (e <= 0) {
+      // Subnormal (or zero) result: shift the full mantissa into place, rounding to nearest even
+      if (e < -10) {
+        return uint16_t(sign);
+      }
+      mantissa |= 0x800000;
+      const auto shift = uint32_t(14 - e);
+      auto m = mantissa >> shift;
+      const auto remainder = mantissa & ((1u << shift) - 1);
+      const auto halfway = 1u << (shift - 1);
+      if (remainder > halfway || (remainder == halfway && (m & 1))) {
+        ++m;
+      }
+      return uint16_t(sign | m);
+    }
+    auto m = mantissa >> 13;
+    const auto remainder = mantissa & 0x1fff;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (m & 1))) {
+      if (++m == 0x400) {
+        m = 0;
+        if (++e >= 0x1f) {
+          return uint16_t(sign | 0x7c00);
+        }
+      }
+    }
+    return uint16_t(sign | (uint32_t(e) << 10) | m);
+  }
+
+  static float toFloat(uint16_t h) {
+    const uint32_t sign = uint32_t(h & 0x8000) << 16;
+    const uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+    if (exponent == 0) {
+      if (mantissa == 0) {
+        return std::bit_cast<float>(sign);
+      }
+      // Subnormal: normalize into a float exponent
+      int e = 1;
+      while (!(mantissa & 0x400)) {
+        mantissa <<= 1;
+        --e;
+      }
+      mantissa &= 0x3ff;
+      return std::bit_cast<float>(sign | (uint32_t(e + 112) << 23) | (mantissa << 13));
+    }
+    if (exponent == 0x1f) {
+      return std::bit_cast<float>(sign | 0x7f800000 | (mantissa << 13));
+    }
+    return std::bit_cast<float>(sign | ((exponent + 112) << 23) | (mantissa << 13));
+  }
+};
+
+// Brain floating point: the upper 16 bits of a float
+struct bfloat16 {
+  uint16_t bits = 0;
+
+  bfloat16() = default;
+  bfloat16(float value) : bits(fromFloat(value)) {}
+  operator float() const { return std::bit_cast<float>(uint32_t(bits) << 16); }
+
+  static uint16_t fromFloat(float value) {
+    const auto x = std::bit_cast<uint32_t>(value);
+    if ((x & 0x7fffffff) > 0x7f800000) {
+      return uint16_t((x >> 16) | 0x40);
+    }
+    // Round to nearest even
+    return uint16_t((x + 0x7fff + ((x >> 16) & 1)) >> 16);
+  }
+};
+
+// Type arithmetic on (and accumulation of) a storage type is carried out in
+template<typename T>
+struct ComputeTypeOf { using type = T; };
+template<>
+struct ComputeTypeOf<float16> { using type = float; };
+template<>
+struct ComputeTypeOf<bfloat16> { using type = float; };
+
+template<typename T>
+using ComputeType = typename ComputeTypeOf<T>::type;
\ No newline at end of file
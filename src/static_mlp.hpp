@@ -0,0 +1,106 @@
+#pragma once
+
+#include "nn.hpp"
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+// Inference only MultilayerPerceptron with the layer sizes as template arguments,
+// e.g. StaticMultilayerPerceptron<3, 4, 4, 1> for a model trained as MultilayerPerceptron({ 3, 4, 4, 1 })
+// - The weights are stored inline in std::arrays: the model is a plain value, and
+//   evaluating it never touches the heap
+// - All loop bounds are constants, so the compiler fully unrolls the small layers, and
+//   the weights are stored input-major so each input is broadcast over a vector of outputs
+// Like MultilayerPerceptron the layers are linear (no activation).
+template<typename T, size_t... Sizes>
+class BasicStaticMultilayerPerceptron {
+  static_assert(sizeof...(Sizes) >= 2, "A model needs at least an input and an output size");
+
+  static constexpr std::array<size_t, sizeof...(Sizes)> LayerSizes{ Sizes... };
+  static constexpr size_t NumberOfLayers = sizeof...(Sizes) - 1;
+public:
+  static constexpr size_t NumberOfInputs = LayerSizes.front();
+  static constexpr size_t NumberOfOutputs = LayerSizes.back();
+
+  template<size_t Inputs, size_t Outputs>
+  struct Layer {
+    // weights[i * Outputs + o] is the weight of input i for output o
+    alignas(64) std::array<T, Inputs * Outputs> weights{};
+    std::array<T, Outputs> biases{};
+
+    std::array<T, Outputs> operator()(const std::array<T, Inputs>& input) const {
+      auto output = biases;
+      for (size_t i=0; i<Inputs; ++i) {
+        for (size_t o=0; o<Outputs; ++o) {
+          output[o] += input[i] * weights[i * Outputs + o];
+        }
+      }
+      return output;
+    }
+  };
+private:
+  template<size_t... K>
+  static auto makeLayers(std::index_sequence<K...>) -> std::tuple<Layer<LayerSizes[K], LayerSizes[K+1]>...>;
+  using Layers = decltype(makeLayers(std::make_index_sequence<NumberOfLayers>()));
+
+  Layers _layers;
+
+  template<size_t K>
+  auto forwardFrom(const std::array<T, LayerSizes[K]>& input) const {
+    if constexpr (K == NumberOfLayers) {
+      return input;
+    } else {
+      return forwardFrom<K + 1>(std::get<K>(_layers)(input));
+    }
+  }
+
+  template<size_t K, typename V>
+  void importLayers(const std::vector<BasicLayer<V>>& layers) {
+    if constexpr (K < NumberOfLayers) {
+      const auto& source = layers[K];
+      auto& layer = std::get<K>(_layers);
+      constexpr auto Inputs = LayerSizes[K];
+      constexpr auto Outputs = LayerSizes[K+1];
+      // BasicLayer rows are per output (neuron), transposed here to input-major
+      const auto weights = source.weights();
+      for (size_t o=0; o<Outputs; ++o) {
+        for (size_t i=0; i<Inputs; ++i) {
+          layer.weights[i * Outputs + o] = T(weights[o * Inputs + i]->_value);
+        }
+        layer.biases[o] = T(source.biases()[o]->_value);
+      }
+      importLayers<K + 1>(layers);
+    }
+  }
+public:
+  // All weights and biases zero
+  BasicStaticMultilayerPerceptron() = default;
+
+  // Copies the parameter values of a trained model with the same layer sizes
+  template<typename V>
+  explicit BasicStaticMultilayerPerceptron(const BasicMultilayerPerceptron<V>& model) {
+    const auto& layers = model.layers();
+    bool matches = layers.size() == NumberOfLayers;
+    for (size_t k=0; matches && k<NumberOfLayers; ++k) {
+      matches = layers[k].numberOfInputs() == LayerSizes[k] && layers[k].numberOfOutputs() == LayerSizes[k+1];
+    }
+    if (!matches) {
+      throw std::runtime_error("Model layer sizes do not match the static layer sizes");
+    }
+    importLayers<0>(layers);
+  }
+
+  std::array<T, NumberOfOutputs> operator()(const std::array<T, NumberOfInputs>& input) const {
+    return forwardFrom<0>(input);
+  }
+
+  template<size_t K>
+  auto& layer() { return std::get<K>(_layers); }
+  template<size_t K>
+  const auto& layer() const { return std::get<K>(_layers); }
+};
+
+template<size_t... Sizes>
+using StaticMultilayerPerceptron = BasicStaticMultilayerPerceptron<double, Sizes...>;
\ No newline at end of file
@@ -0,0 +1,219 @@
+#pragma once
+
+#include "engine.hpp"
+#include <cstdint>
+#include <vector>
+#include <cmath>
+#include <span>
+
+// Alternative autograd engine recording every operation onto a flat tape
+// Instead of a graph of individually allocated nodes, operations are appended in
+// creation order to contiguous structure-of-arrays storage:
+// - operation code, left/right input indices, value and gradient
+// Since inputs are always recorded before their results, creation order is already
+// a topological order: backwards is a single reverse linear sweep, no sort required.
+//
+// Values are referred to by TapeValue handles which mirror the ValuePtr interface
+// (operators, ->_value, ->_grad, ->backwards()), so nn.hpp can run on either engine.
+class Tape {
+  std::vector<Operation> _operations;
+  std::vector<uint32_t> _lhs;
+  std::vector<uint32_t> _rhs;
+  std::vector<double> _values;
+  std::vector<double> _grads;
+
+  static Tape*& currentRef() {
+    thread_local Tape* tape = nullptr;
+    return tape;
+  }
+public:
+  static constexpr uint32_t None = UINT32_MAX;
+
+  // Records an operation and returns its index
+  // Power operations reference their exponent as a (constant) right hand input
+  uint32_t push(Operation operation, double value, uint32_t lhs = None, uint32_t rhs = None) {
+    _operations.push_back(operation);
+    _lhs.push_back(lhs);
+    _rhs.push_back(rhs);
+    _values.push_back(value);
+    _grads.push_back(0.0);
+    return uint32_t(_values.size() - 1);
+  }
+
+  size_t size() const { return _values.size(); }
+
+  // Discards every entry recorded after 'mark' (e.g. the per-step graph, keeping parameters)
+  // Storage capacity is retained so re-recording a graph of the same size does not allocate
+  void truncate(size_t mark) {
+    _operations.resize(mark);
+    _lhs.resize(mark);
+    _rhs.resize(mark);
+    _values.resize(mark);
+    _grads.resize(mark);
+  }
+  void clear() { truncate(0); }
+
+  double& value(uint32_t index) { return _values[index]; }
+  double& grad(uint32_t index) { return _grads[index]; }
+  // Every recorded value/gradient, e.g. values().first(mark) are the parameters recorded before 'mark'
+  std::span<double> values() { return _values; }
+  std::span<double> grads() { return _grads; }
+
+  void backwards(uint32_t root) {
+    _grads[root] = 1.0;
+    for (uint32_t i=root+1; i-- > 0;) {
+      const auto grad = _grads[i];
+      const auto lhs = _lhs[i];
+      const auto rhs = _rhs[i];
+      switch (_operations[i]) {
+        case Operation::Null:
+          break;
+        case Operation::Addition:
+          _grads[lhs] += grad;
+          _grads[rhs] += grad;
+          break;
+        case Operation::Multiplication:
+          _grads[lhs] += _values[rhs] * grad;
+          _grads[rhs] += _values[lhs] * grad;
+          break;
+        case Operation::Power:
+          _grads[lhs] += (_values[rhs] * std::pow(_values[lhs], _values[rhs]-1)) * grad;
+          break;
+        case Operation::RELU:
+          _grads[lhs] += double(_values[i] > 0.0) * grad;
+          break;
+        case Operation::Subtraction:
+          _grads[lhs] += grad;
+          _grads[rhs] -= grad;
+          break;
+        case Operation::Division:
+          _grads[lhs] += grad / _values[rhs];
+          _grads[rhs] -= grad * _values[i] / _values[rhs];
+          break;
+        case Operation::SquaredError: {
+          const auto delta = 2.0 * (_values[lhs] - _values[rhs]) * grad;
+          _grads[lhs] += delta;
+          _grads[rhs] -= delta;
+          break;
+        }
+        case Operation::MultiplyAdd:
+          // Entries only have two inputs, multiplyAdd records a multiplication and an addition instead
+          break;
+      }
+    }
+  }
+
+  static Tape* current() { return currentRef(); }
+
+  // Makes the tape the one new values are recorded onto for the calling thread
+  class Scope {
+    Tape* _previous;
+  public:
+    Scope(Tape& tape) : _previous(currentRef()) { currentRef() = &tape; }
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+    ~Scope() { currentRef() = _previous; }
+  };
+};
+
+// Handle to an entry on a Tape
+struct TapeValue {
+  Tape* _tape = nullptr;
+  uint32_t _index = Tape::None;
+
+  // Field style access to the referenced entry, matching that of Value
+  struct Entry {
+    double& _value;
+    double& _grad;
+    Tape& _tape;
+    uint32_t _index;
+
+    void zeroGrad() { _grad = 0.0; }
+    void backwards() { _tape.backwards(_index); }
+  };
+  struct Accessor {
+    Entry entry;
+    Entry* operator->() { return &entry; }
+  };
+  Accessor operator->() const {
+    return Accessor{ Entry{ _tape->value(_index), _tape->grad(_index), *_tape, _index } };
+  }
+
+  // Records a leaf value onto the current thread's tape
+  static TapeValue make(double value) {
+    auto tape = Tape::current();
+    if (!tape) {
+      throw std::runtime_error("No tape is active on this thread");
+    }
+    return { tape, tape->push(Operation::Null, value) };
+  }
+};
+
+TapeValue operator+(const TapeValue& a, const TapeValue& b)
+{
+  auto& tape = *a._tape;
+  return { &tape, tape.push(Operation::Addition, tape.value(a._index) + tape.value(b._index), a._index, b._index) };
+}
+TapeValue operator*(const TapeValue& a, const TapeValue& b)
+{
+  auto& tape = *a._tape;
+  return { &tape, tape.push(Operation::Multiplication, tape.value(a._index) * tape.value(b._index), a._index, b._index) };
+}
+TapeValue power(const TapeValue& a, double value)
+{
+  auto& tape = *a._tape;
+  const auto exponent = tape.push(Operation::Null, value);
+  return { &tape, tape.push(Operation::Power, std::pow(tape.value(a._index), value), a._index, exponent) };
+}
+TapeValue operator-(const TapeValue& a)
+{
+  auto& tape = *a._tape;
+  return a * TapeValue{ &tape, tape.push(Operation::Null, -1.0) };
+}
+TapeValue operator/(const TapeValue& a, const TapeValue& b)
+{
+  auto& tape = *a._tape;
+  return { &tape, tape.push(Operation::Division, tape.value(a._index) / tape.value(b._index), a._index, b._index) };
+}
+TapeValue operator-(const TapeValue& a, const TapeValue& b)
+{
+  auto& tape = *a._tape;
+  return { &tape, tape.push(Operation::Subtraction, tape.value(a._index) - tape.value(b._index), a._index, b._index) };
+}
+TapeValue multiplyAdd(const TapeValue& a, const TapeValue& b, const TapeValue& c)
+{
+  return a * b + c;
+}
+TapeValue squaredError(const TapeValue& a, const TapeValue& b)
+{
+  auto& tape = *a._tape;
+  const auto delta = tape.value(a._index) - tape.value(b._index);
+  return { &tape, tape.push(Operation::SquaredError, delta * delta, a._index, b._index) };
+}
+TapeValue relu(const TapeValue& a)
+{
+  auto& tape = *a._tape;
+  const auto value = tape.value(a._index);
+  return { &tape, tape.push(Operation::RELU, (value > 0.0 ? value : 0.0), a._index) };
+}
+
+std::ostream& operator<<(std::ostream& os, const TapeValue& value)
+{
+  os << value->_value;
+  return os;
+}
+
+template<>
+struct ValueTraits<TapeValue> {
+  static TapeValue make(double value) { return TapeValue::make(value); }
+
+  // Consecutive entries of the current tape, whose values()/grads() are then flat arrays
+  static std::vector<TapeValue> makeParameters(std::span<const double> values) {
+    std::vector<TapeValue> result;
+    result.reserve(values.size());
+    for (auto value : values) {
+      result.push_back(TapeValue::make(value));
+    }
+    return result;
+  }
+};
\ No newline at end of file
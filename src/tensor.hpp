@@ -1,25 +1,67 @@
 #pragma once
 
+#include <algorithm>
 #include <vector>
 #include <iostream>
 #include <functional>
+#include <memory>
+#include <span>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+#include <type_traits>
 
-class Tensor {
-  std::vector<double> _data;
+#include "matmul.hpp"
+#include "memory_pool.hpp"
+#include "reduce.hpp"
+#include "scalar.hpp"
+#include "thread_pool.hpp"
+
+// N-dimensional array of elements of type T (float, double, or storage-only float16/bfloat16)
+// Tensors are views: a reference counted storage buffer plus an offset, shape and strides.
+// Copying, indexing with operator[], view() and transpose() therefore share the
+// underlying storage and cost O(1) regardless of the tensor size.
+// Use clone() for an independent copy and contiguous() for a compact row-major layout.
+template<typename T>
+class BasicTensor {
+  template<typename U>
+  friend class BasicTensor;
+public:
+  // Type the elements are stored as, and the type arithmetic on them is carried out in
+  using Element = T;
+  using Compute = ComputeType<T>;
+private:
+  std::shared_ptr<T[]> _storage;
+  size_t _offset = 0;
   std::vector<size_t> _shape;
   std::vector<size_t> _strides;
 
   size_t getStride(size_t dim) const {
     return _strides[dim];
   }
-  auto buildStrides() {
-    std::vector<size_t> strides(_shape.size());
+  static auto buildStrides(const std::vector<size_t>& shape) {
+    std::vector<size_t> strides(shape.size());
+    if (shape.empty()) {
+      return strides;
+    }
     strides.back() = 1;
-    for (int i=_shape.size()-2; i>=0; --i) {
-      strides[i] = strides[i+1] * _shape[i];
+    for (int i=shape.size()-2; i>=0; --i) {
+      strides[i] = strides[i+1] * shape[i+1];
     }
     return strides;
   }
+  // Elementwise operations and reductions are split across the global thread pool
+  // in blocks of this many elements once a tensor spans more than one block
+  static constexpr size_t ParallelBlock = size_t(1) << 14;
+
+  template<typename Func>
+  static void forBlocks(size_t size, Func&& fn) {
+    if (size <= ParallelBlock) {
+      fn(0, size);
+    } else {
+      ThreadPool::global().parallelFor(0, size, ParallelBlock, fn);
+    }
+  }
   static auto getSize(const std::vector<size_t>& shape) {
     size_t size = 1;
     for (const auto& s : shape) {
@@ -27,194 +69,635 @@ class Tensor {
     }
     return size;
   }
+  // Uninitialized row-major storage for 'size' elements, from the tensor memory pool
+  static std::shared_ptr<T[]> allocate(size_t size) {
+    return MemoryPool::global().makeShared<T>(size);
+  }
+
+  BasicTensor(std::shared_ptr<T[]> storage, size_t offset, std::vector<size_t> shape, std::vector<size_t> strides)
+  : _storage(std::move(storage)),
+  _offset(offset),
+  _shape(std::move(shape)),
+  _strides(std::move(strides))
+  {}
+
+  const T* address() const { return _storage.get() + _offset; }
+  T* mutableAddress() { return _storage.get() + _offset; }
+
+  // Offset of the first element of the given row (index over all but the last dimension)
+  static size_t rowOffset(size_t row, const std::vector<size_t>& shape, const std::vector<size_t>& strides) {
+    size_t offset = 0;
+    for (size_t d = shape.size() - 1; d-- > 0;) {
+      offset += (row % shape[d]) * strides[d];
+      row /= shape[d];
+    }
+    return offset;
+  }
+  // Calls fn(rowBegin, rowEnd) over the rows of 'shape', in parallel if it is large enough
+  template<typename Func>
+  static void forRows(const std::vector<size_t>& shape, Func&& fn) {
+    const auto columns = shape.empty() ? 1 : shape.back();
+    const auto rows = columns == 0 ? 0 : getSize(shape) / columns;
+    if (rows * columns <= ParallelBlock) {
+      fn(0, rows);
+    } else {
+      ThreadPool::global().parallelFor(0, rows, std::max<size_t>(1, ParallelBlock / std::max<size_t>(columns, 1)), fn);
+    }
+  }
+  static size_t innerStride(const std::vector<size_t>& strides) {
+    return strides.empty() ? 1 : strides.back();
+  }
+
+  // Combines each element with the corresponding (broadcast) element of 'other'
+  template<typename Func>
+  BasicTensor zip(const BasicTensor& other, Func&& fn) const {
+    if (_shape == other._shape && isContiguous() && other.isContiguous()) {
+      const auto lhs = address();
+      const auto rhs = other.address();
+      return generate(_shape, [&](size_t i) { return fn(Compute(lhs[i]), Compute(rhs[i])); });
+    }
+    auto shape = broadcastShape(_shape, other._shape);
+    const auto a = broadcastTo(shape);
+    const auto b = other.broadcastTo(shape);
+    const auto columns = shape.empty() ? 1 : shape.back();
+    const auto sa = innerStride(a._strides);
+    const auto sb = innerStride(b._strides);
+    auto data = allocate(getSize(shape));
+    forRows(shape, [&](size_t begin, size_t end) {
+      for (auto row=begin; row<end; ++row) {
+        const auto lhs = a.address() + rowOffset(row, shape, a._strides);
+        const auto rhs = b.address() + rowOffset(row, shape, b._strides);
+        auto out = data.get() + row * columns;
+        for (size_t j=0; j<columns; ++j) {
+          out[j] = T(fn(Compute(lhs[j*sa]), Compute(rhs[j*sb])));
+        }
+      }
+    });
+    return fromStorage(std::move(data), 0, std::move(shape));
+  }
+
+  // Replaces each element (through this view's strides) with fn(element, broadcast element of 'other')
+  template<typename Func>
+  BasicTensor& zipInPlace(const BasicTensor& other, Func&& fn) {
+    // Reading from an overlapping view while writing would observe partially updated values
+    const auto source = sharesStorage(other) && !(other._offset == _offset && other._strides == _strides)
+      ? other.clone()
+      : other;
+    const auto b = source.broadcastTo(_shape);
+    const auto columns = _shape.empty() ? 1 : _shape.back();
+    const auto sa = innerStride(_strides);
+    const auto sb = innerStride(b._strides);
+    forRows(_shape, [&](size_t begin, size_t end) {
+      for (auto row=begin; row<end; ++row) {
+        auto lhs = mutableAddress() + rowOffset(row, _shape, _strides);
+        const auto rhs = b.address() + rowOffset(row, _shape, b._strides);
+        for (size_t j=0; j<columns; ++j) {
+          lhs[j*sa] = T(fn(Compute(lhs[j*sa]), Compute(rhs[j*sb])));
+        }
+      }
+    });
+    return *this;
+  }
+
+  std::vector<size_t> reducedShape(size_t axis, bool keepDims) const {
+    if (axis >= _shape.size()) {
+      throw std::runtime_error("Reduction axis is out of range");
+    }
+    auto shape = _shape;
+    if (keepDims) {
+      shape[axis] = 1;
+    } else {
+      shape.erase(shape.begin() + axis);
+    }
+    return shape.empty() ? std::vector<size_t>{ 1 } : shape;
+  }
+  // Splits the row-major elements as [outer, length, inner] around 'axis' and calls
+  // fn(first element, length, inner, width, result index) for tiles of 'width' adjacent
+  // inner positions, element k of column j of a tile being at first[k * inner + j]
+  template<typename Func>
+  void forAxisTiles(size_t axis, Func&& fn) const {
+    const auto source = contiguous();
+    const auto in = source.address();
+    size_t outer = 1;
+    for (size_t d=0; d<axis; ++d) {
+      outer *= _shape[d];
+    }
+    const auto length = _shape[axis];
+    size_t inner = 1;
+    for (size_t d=axis+1; d<_shape.size(); ++d) {
+      inner *= _shape[d];
+    }
+    const auto chunks = (inner + kernels::MaxColumns - 1) / kernels::MaxColumns;
+    const auto run = [&](size_t begin, size_t end) {
+      for (auto t=begin; t<end; ++t) {
+        const auto o = t / chunks;
+        const auto i = (t % chunks) * kernels::MaxColumns;
+        fn(in + o * length * inner + i, length, inner, std::min(kernels::MaxColumns, inner - i), o * inner + i);
+      }
+    };
+    const auto tiles = outer * chunks;
+    const auto tileSize = std::max<size_t>(1, length * std::min(inner, kernels::MaxColumns));
+    if (size() <= ParallelBlock) {
+      run(0, tiles);
+    } else {
+      ThreadPool::global().parallelFor(0, tiles, std::max<size_t>(1, ParallelBlock / tileSize), run);
+    }
+  }
 public:
-  Tensor(std::vector<double> data, std::vector<size_t> shape)
-  : _data(data),
-  _shape(shape),
-  _strides(buildStrides())
+  // No storage: a placeholder for a tensor assigned later (see hasStorage())
+  BasicTensor() = default;
+  // Copies 'data' into pooled (aligned) storage
+  // Results computed element by element are better built in place with generate()
+  BasicTensor(const std::vector<T>& data, std::vector<size_t> shape)
+  : _offset(0),
+  _shape(std::move(shape)),
+  _strides(buildStrides(_shape))
   {
-    if (getSize(shape) != data.size()) {
+    if (getSize(_shape) != data.size()) {
       throw std::runtime_error("Data size does not match shape");
     }
+    _storage = allocate(data.size());
+    std::copy(data.begin(), data.end(), _storage.get());
   }
-  Tensor operator[](std::initializer_list<size_t> indices) const {
-    size_t pos = 0;
+  // Selects the sub-tensor at the given leading indices (a view, no data is copied)
+  BasicTensor operator[](std::initializer_list<size_t> indices) const {
+    size_t pos = _offset;
     for (size_t i=0; i<indices.size(); ++i) {
       const auto stride = getStride(i);
       pos += *(indices.begin() + i) * stride;
     }
 
     if (indices.size() == _shape.size()) {
-      return Tensor({_data[pos]}, {1});
+      return BasicTensor(_storage, pos, {1}, {1});
     } else {
-      std::vector<double> data;
-      const auto shape = std::vector<size_t>(_shape.begin() + indices.size(), _shape.end());
-      const auto size = getSize(shape);
-      for (size_t i=0; i<size; ++i) {
-        data.push_back(_data[pos + i]);
-      }
-      return Tensor(data, shape);
+      return BasicTensor(
+        _storage,
+        pos,
+        std::vector<size_t>(_shape.begin() + indices.size(), _shape.end()),
+        std::vector<size_t>(_strides.begin() + indices.size(), _strides.end()));
     }
   }
-  double element() const {
-    if (_data.size() != 1) {
+  Compute element() const {
+    if (size() != 1) {
       throw std::runtime_error("Tensor does not have a single element");
     }
-    return _data[0];
+    return Compute(*address());
+  }
+  // Reinterprets the elements with a different shape of the same size (a view, no data is copied)
+  BasicTensor view(std::vector<size_t> shape) const {
+    if (getSize(shape) != size()) {
+      throw std::runtime_error("View size does not match shape");
+    }
+    if (!isContiguous()) {
+      throw std::runtime_error("Only contiguous tensors can be viewed with a different shape");
+    }
+    auto strides = buildStrides(shape);
+    return BasicTensor(_storage, _offset, std::move(shape), std::move(strides));
+  }
+  BasicTensor view(std::initializer_list<size_t> shape) const { return view(std::vector<size_t>(shape)); }
+  // Rows [begin, end) along the first dimension (a view, no data is copied)
+  BasicTensor slice(size_t begin, size_t end) const {
+    if (_shape.empty() || begin > end || end > _shape[0]) {
+      throw std::runtime_error("Slice is out of range");
+    }
+    auto shape = _shape;
+    shape[0] = end - begin;
+    return BasicTensor(_storage, _offset + begin * _strides[0], std::move(shape), _strides);
   }
-  Tensor view(std::initializer_list<size_t> shape) { return Tensor(_data, shape); }
 
+  // Checked without building the row-major strides, as it guards every element access path
+  bool isContiguous() const {
+    size_t expected = 1;
+    for (size_t d=_shape.size(); d-- > 0;) {
+      if (_strides[d] != expected) {
+        return false;
+      }
+      expected *= _shape[d];
+    }
+    return true;
+  }
+  // Deep copy of the elements into new row-major storage
+  BasicTensor clone() const {
+    const auto n = size();
+    auto data = allocate(n);
+    if (isContiguous()) {
+      std::copy(address(), address() + n, data.get());
+    } else {
+      // Walk the elements in row-major order, carrying the index over each dimension
+      std::vector<size_t> index(_shape.size(), 0);
+      for (size_t i=0; i<n; ++i) {
+        size_t pos = _offset;
+        for (size_t d=0; d<_shape.size(); ++d) {
+          pos += index[d] * _strides[d];
+        }
+        data[i] = _storage[pos];
+        for (size_t d=_shape.size(); d-- > 0;) {
+          if (++index[d] < _shape[d]) {
+            break;
+          }
+          index[d] = 0;
+        }
+      }
+    }
+    return fromStorage(std::move(data), 0, _shape);
+  }
+  // This tensor if it is already laid out row-major, otherwise a compact copy
+  BasicTensor contiguous() const {
+    return isContiguous() ? *this : clone();
+  }
 
+  // Creates a tensor whose elements are fn(row-major index)
+  // Note: 'fn' may be invoked concurrently for large tensors
   template<typename Func>
-  Tensor apply(Func&& fn) {
-    std::vector<double> data;
-    for (size_t i=0; i<_data.size(); ++i) {
-      data.push_back(fn(_data[i], i));
-    }
-    return Tensor(data, _shape);
+  static BasicTensor generate(std::vector<size_t> shape, Func&& fn) {
+    const auto n = getSize(shape);
+    auto data = allocate(n);
+    const auto out = data.get();
+    forBlocks(n, [&](size_t begin, size_t end) {
+      for (size_t i=begin; i<end; ++i) {
+        out[i] = T(fn(i));
+      }
+    });
+    return fromStorage(std::move(data), 0, std::move(shape));
   }
 
-  Tensor operator+(const Tensor& other) {
-    return apply([&other](double d, size_t i) { return d + other._data[i]; });
+  // Row-major view of 'shape' elements of externally owned storage, starting at 'offset'
+  // Writes through the view (in-place operators) are visible to every other user of the storage
+  static BasicTensor fromStorage(std::shared_ptr<T[]> storage, size_t offset, std::vector<size_t> shape) {
+    auto strides = buildStrides(shape);
+    return BasicTensor(std::move(storage), offset, std::move(shape), std::move(strides));
   }
-  Tensor operator*(const Tensor& other) {
-    return apply([&other](double d, size_t i) { return d * other._data[i]; });
+
+  // 'fn' receives each element and its row-major index, and may also be invoked concurrently
+  template<typename Func>
+  BasicTensor apply(Func&& fn) const {
+    const auto source = contiguous();
+    const auto input = source.address();
+    return generate(_shape, [&](size_t i) { return fn(Compute(input[i]), i); });
+  }
+
+  BasicTensor operator+(const BasicTensor& other) const {
+    return zip(other, [](Compute a, Compute b) { return a + b; });
+  }
+  BasicTensor operator*(const BasicTensor& other) const {
+    return zip(other, [](Compute a, Compute b) { return a * b; });
   }
-  Tensor operator/(const Tensor& other) {
-    return apply([&other](double d, size_t i) { return d / other._data[i]; });
+  BasicTensor operator/(const BasicTensor& other) const {
+    return zip(other, [](Compute a, Compute b) { return a / b; });
   }
-  Tensor operator-(const Tensor& other) {
-    return apply([&other](double d, size_t i) { return d - other._data[i]; });
+  BasicTensor operator-(const BasicTensor& other) const {
+    return zip(other, [](Compute a, Compute b) { return a - b; });
   }
-  Tensor operator+(double value) {
-    return apply([value](double d, size_t) { return d + value; });
+  BasicTensor operator+(double value) const {
+    return apply([value = Compute(value)](Compute d, size_t) { return d + value; });
   }
-  Tensor operator*(double value) {
-    return apply([value](double d, size_t) { return d * value; });
+  BasicTensor operator*(double value) const {
+    return apply([value = Compute(value)](Compute d, size_t) { return d * value; });
   }
-  Tensor operator/(double value) {
-    return apply([value](double d, size_t) { return d / value; });
+  BasicTensor operator/(double value) const {
+    return apply([value = Compute(value)](Compute d, size_t) { return d / value; });
+  }
+  BasicTensor operator-(double value) const {
+    return apply([value = Compute(value)](Compute d, size_t) { return d - value; });
+  }
+
+  // In-place variants: update this tensor's elements without allocating
+  // Note: the storage is shared with every copy and view of this tensor, which all observe the update
+  BasicTensor& operator+=(const BasicTensor& other) { return zipInPlace(other, [](Compute a, Compute b) { return a + b; }); }
+  BasicTensor& operator-=(const BasicTensor& other) { return zipInPlace(other, [](Compute a, Compute b) { return a - b; }); }
+  BasicTensor& operator*=(const BasicTensor& other) { return zipInPlace(other, [](Compute a, Compute b) { return a * b; }); }
+  BasicTensor& operator/=(const BasicTensor& other) { return zipInPlace(other, [](Compute a, Compute b) { return a / b; }); }
+  BasicTensor& operator+=(double value) { return apply_([value = Compute(value)](Compute d) { return d + value; }); }
+  BasicTensor& operator-=(double value) { return apply_([value = Compute(value)](Compute d) { return d - value; }); }
+  BasicTensor& operator*=(double value) { return apply_([value = Compute(value)](Compute d) { return d * value; }); }
+  BasicTensor& operator/=(double value) { return apply_([value = Compute(value)](Compute d) { return d / value; }); }
+
+  // Replaces each element with fn(element)
+  template<typename Func>
+  BasicTensor& apply_(Func&& fn) {
+    const auto columns = _shape.empty() ? 1 : _shape.back();
+    const auto stride = innerStride(_strides);
+    forRows(_shape, [&](size_t begin, size_t end) {
+      for (auto row=begin; row<end; ++row) {
+        auto values = mutableAddress() + rowOffset(row, _shape, _strides);
+        for (size_t j=0; j<columns; ++j) {
+          values[j*stride] = T(fn(Compute(values[j*stride])));
+        }
+      }
+    });
+    return *this;
   }
-  Tensor operator-(double value) {
-    return apply([value](double d, size_t) { return d - value; });
+  BasicTensor& fill_(double value) { return apply_([value = Compute(value)](Compute) { return value; }); }
+  BasicTensor& relu_() { return apply_([](Compute d) { return d > Compute(0) ? d : Compute(0); }); }
+  BasicTensor& power_(double value) { return apply_([value = Compute(value)](Compute d) { return Compute(std::pow(d, value)); }); }
+
+  // Shape resulting from combining the two shapes elementwise (numpy broadcasting rules):
+  // aligned from the trailing dimension, each pair of sizes must match or one of them be 1
+  static std::vector<size_t> broadcastShape(const std::vector<size_t>& a, const std::vector<size_t>& b) {
+    std::vector<size_t> result(std::max(a.size(), b.size()));
+    for (size_t i=0; i<result.size(); ++i) {
+      const auto da = i < a.size() ? a[a.size()-1-i] : 1;
+      const auto db = i < b.size() ? b[b.size()-1-i] : 1;
+      if (da != db && da != 1 && db != 1) {
+        throw std::runtime_error("Tensor shapes cannot be broadcast together");
+      }
+      result[result.size()-1-i] = da == 1 ? db : da;
+    }
+    return result;
   }
-  Tensor matmul(const Tensor& other) {
+  // Expands to 'shape' by repeating dimensions of size 1 (a view with zero strides, no data is copied)
+  BasicTensor broadcastTo(const std::vector<size_t>& shape) const {
+    if (shape == _shape) {
+      return *this;
+    }
+    if (shape.size() < _shape.size()) {
+      throw std::runtime_error("Tensor cannot be broadcast to a shape with fewer dimensions");
+    }
+    std::vector<size_t> strides(shape.size(), 0);
+    const auto leading = shape.size() - _shape.size();
+    for (size_t i=0; i<_shape.size(); ++i) {
+      if (_shape[i] == shape[leading + i]) {
+        strides[leading + i] = _strides[i];
+      } else if (_shape[i] != 1) {
+        throw std::runtime_error("Tensor cannot be broadcast to shape");
+      }
+    }
+    return BasicTensor(_storage, _offset, shape, std::move(strides));
+  }
+  // Sums over broadcast dimensions to reduce to 'shape' (the inverse of broadcastTo, e.g. for gradients)
+  BasicTensor sumTo(const std::vector<size_t>& shape) const {
+    if (shape == _shape) {
+      return *this;
+    }
+    auto result = zeros(shape);
+    auto target = result.broadcastTo(_shape);
+    const auto source = contiguous();
+    const auto columns = _shape.empty() ? 1 : _shape.back();
+    const auto rows = columns == 0 ? 0 : size() / columns;
+    const auto stride = innerStride(target._strides);
+    // Serial: broadcast elements of the target alias each other
+    for (size_t row=0; row<rows; ++row) {
+      auto out = target.mutableAddress() + rowOffset(row, _shape, target._strides);
+      const auto in = source.address() + row * columns;
+      for (size_t j=0; j<columns; ++j) {
+        out[j*stride] = T(Compute(out[j*stride]) + Compute(in[j]));
+      }
+    }
+    return result;
+  }
+  BasicTensor matmul(const BasicTensor& other) const {
     // matrix multiplication is row by column
     // [a, b] * [c,
     //          d] = [a*c + b*d]
     // The resultant matrix will have the shape of [1st matrix rows, 2nd matrix columns]
     // The number of columns in the 1st matrix must be equal to the number of rows in the 2nd matrix
     assert(_shape.size() == 2);
-    assert(other._shape == _shape);
-    std::vector<double> data;
-    for (size_t i=0; i<_shape[0]; ++i) {
-      for (size_t j=0; j<other._shape[1]; ++j) {
-        double sum = 0.0;
-        for (size_t k=0; k<_shape[1]; ++k) {
-          sum += _data[i*_shape[1] + k] * other._data[k*other._shape[1] + j];
-        }
-        data.push_back(sum);
-      }
+    assert(other._shape.size() == 2);
+    assert(_shape[1] == other._shape[0]);
+    const auto m = _shape[0];
+    const auto k = _shape[1];
+    const auto n = other._shape[1];
+    // Accumulated in the compute type, converted back if that differs from the storage type
+    auto data = BasicTensor<Compute>::allocate(m * n);
+    std::fill_n(data.get(), m * n, Compute(0));
+    kernels::gemmParallel(
+      ThreadPool::global(), m, n, k,
+      address(), _strides[0], _strides[1],
+      other.address(), other._strides[0], other._strides[1],
+      data.get(), n);
+    if constexpr (std::is_same_v<T, Compute>) {
+      return fromStorage(std::move(data), 0, {_shape[0], other._shape[1]});
+    } else {
+      auto converted = allocate(m * n);
+      std::copy_n(data.get(), m * n, converted.get());
+      return fromStorage(std::move(converted), 0, {_shape[0], other._shape[1]});
     }
-    return Tensor(data, {_shape[0], other._shape[1]});
   }
 
-  friend std::ostream& operator<<(std::ostream& os, const Tensor& t) {
+  // Swaps the two dimensions of a matrix (a view, no data is copied)
+  BasicTensor transpose() const {
+    assert(_shape.size() == 2);
+    return BasicTensor(_storage, _offset, {_shape[1], _shape[0]}, {_strides[1], _strides[0]});
+  }
+
+  friend std::ostream& operator<<(std::ostream& os, const BasicTensor& tensor) {
+    const auto t = tensor.contiguous();
+    const auto data = t.data();
     if (t._shape.size() > 2) {
       throw std::runtime_error("Only 1D and 2D tensors are supported");
     }
     if (t._shape.size() == 1) {
       os << '[';
       for (size_t i=0; i<t._shape[0]; ++i) {
-        os << t._data[i] << ' ';
+        os << Compute(data[i]) << ' ';
       }
       os << ']';
     } else {
       for (size_t i=0; i<t._shape[0]; ++i) {
         os << '[';
         for (size_t j=0; j<t._shape[1]; ++j) {
-          os << t._data[i*t._shape[1] + j] << ' ';
+          os << Compute(data[i*t._shape[1] + j]) << ' ';
         }
         os << ']' << std::endl;
       }
     }
     return os;
   }
-  bool operator==(const Tensor& other) const {
+  bool operator==(const BasicTensor& other) const {
     if (_shape != other._shape) {
       return false;
     }
-    if (_data.size() != other._data.size()) {
-      return false;
+    const auto lhs = contiguous();
+    const auto rhs = other.contiguous();
+    return std::equal(lhs.address(), lhs.address() + lhs.size(), rhs.address(), [](const T& a, const T& b) {
+      return Compute(a) == Compute(b);
+    });
+  }
+  bool operator!=(const BasicTensor& other) const {
+    return !(*this == other);
+  }
+  static BasicTensor fill(std::vector<size_t> shape, double value) {
+    const auto n = getSize(shape);
+    auto data = allocate(n);
+    std::fill_n(data.get(), n, T(Compute(value)));
+    return fromStorage(std::move(data), 0, std::move(shape));
+  }
+  static BasicTensor zeros(std::vector<size_t> shape) { return fill(shape, 0.0); }
+  static BasicTensor ones(std::vector<size_t> shape) { return fill(shape, 1.0); }
+  static BasicTensor random(std::vector<size_t> shape) {
+    const auto n = getSize(shape);
+    auto data = allocate(n);
+    for (size_t i=0; i<n; ++i) {
+      data[i] = T(Compute((double)rand() / RAND_MAX));
     }
-    for (size_t i=0; i<_data.size(); ++i) {
-      if (_data[i] != other._data[i]) {
-        return false;
-      }
+    return fromStorage(std::move(data), 0, std::move(shape));
+  }
+  const auto& shape() const { return _shape; }
+  const auto& strides() const { return _strides; }
+  // Elements of a contiguous tensor
+  std::span<const T> data() const {
+    if (!isContiguous()) {
+      throw std::runtime_error("Only contiguous tensors expose their data directly");
     }
-    return true;
+    return { address(), size() };
+  }
+  size_t size() const { return getSize(_shape); }
+  // False for a default constructed placeholder
+  bool hasStorage() const { return _storage != nullptr; }
+  // True if both tensors are views onto the same storage
+  bool sharesStorage(const BasicTensor& other) const { return _storage == other._storage; }
+  // Pairwise sum of all elements (see kernels::pairwiseSum)
+  Compute sum() const {
+    const auto source = contiguous();
+    const auto data = source.address();
+    const auto n = source.size();
+    // Per block partial sums, combined in order so the result does not depend on the thread count
+    const auto blocks = (n + ParallelBlock - 1) / ParallelBlock;
+    if (blocks <= 1) {
+      return kernels::pairwiseSum<Compute>(n, [data](size_t i) { return Compute(data[i]); });
+    }
+    std::vector<Compute> partials(blocks, Compute(0));
+    ThreadPool::global().parallelFor(0, blocks, 1, [&](size_t begin, size_t end) {
+      for (auto b=begin; b<end; ++b) {
+        const auto first = b * ParallelBlock;
+        const auto count = std::min(n, first + ParallelBlock) - first;
+        partials[b] = kernels::pairwiseSum<Compute>(count, [data](size_t i) { return Compute(data[i]); }, first);
+      }
+    });
+    return kernels::pairwiseSum<Compute>(blocks, [&partials](size_t i) { return partials[i]; });
   }
-  bool operator!=(const Tensor& other) const {
-    return !(*this == other);
+  Compute mean() const {
+    return sum() / Compute(size());
   }
-  static Tensor fill(std::vector<size_t> shape, double value) {
-    std::vector<double> data(getSize(shape), value);
-    return Tensor(data, shape);
+  Compute max() const {
+    if (size() == 0) {
+      throw std::runtime_error("Maximum of an empty tensor");
+    }
+    return contiguous().view({ size() }).max(0).element();
   }
-  static Tensor zeros(std::vector<size_t> shape) { return fill(shape, 0.0); }
-  static Tensor ones(std::vector<size_t> shape) { return fill(shape, 1.0); }
-  static Tensor random(std::vector<size_t> shape) {
-    std::vector<double> data;
-    for (size_t i=0; i<getSize(shape); ++i) {
-      data.push_back((double)rand() / RAND_MAX);
+
+  // Reductions over one dimension: the result has that dimension removed
+  // (or kept with size 1 if 'keepDims'), a 1 dimensional input reducing to shape [1]
+  // They run over tiles of up to kernels::MaxColumns results, in parallel for large tensors.
+  BasicTensor sum(size_t axis, bool keepDims = false) const {
+    auto shape = reducedShape(axis, keepDims);
+    if (size() == _shape[axis]) {
+      return fill(std::move(shape), double(sum()));
     }
-    return Tensor(data, shape);
+    auto data = allocate(getSize(shape));
+    const auto out = data.get();
+    forAxisTiles(axis, [out](const T* in, size_t length, size_t inner, size_t width, size_t index) {
+      if (inner == 1) {
+        out[index] = T(kernels::pairwiseSum<Compute>(length, [in](size_t k) { return Compute(in[k]); }));
+        return;
+      }
+      std::array<Compute, kernels::MaxColumns> sums;
+      kernels::pairwiseSumRows<Compute>(length, width, sums.data(), [in, inner](size_t k, size_t j) { return Compute(in[k * inner + j]); });
+      for (size_t j=0; j<width; ++j) {
+        out[index + j] = T(sums[j]);
+      }
+    });
+    return fromStorage(std::move(data), 0, std::move(shape));
   }
-  const auto& shape() const { return _shape; }
-  const auto& data() const { return _data; }
-  auto sum() const {
-    double result = 0.0;
-    for (const auto& d : _data) {
-      result += d;
+  BasicTensor mean(size_t axis, bool keepDims = false) const {
+    auto result = sum(axis, keepDims);
+    result /= double(_shape[axis]);
+    return result;
+  }
+  BasicTensor max(size_t axis, bool keepDims = false) const {
+    auto shape = reducedShape(axis, keepDims);
+    if (_shape[axis] == 0) {
+      throw std::runtime_error("Maximum over an empty dimension");
     }
+    auto data = allocate(getSize(shape));
+    const auto out = data.get();
+    forAxisTiles(axis, [out](const T* in, size_t length, size_t inner, size_t width, size_t index) {
+      if (inner == 1) {
+        out[index] = T(kernels::maximum<Compute>(length, [in](size_t k) { return Compute(in[k]); }));
+        return;
+      }
+      std::array<Compute, kernels::MaxColumns> best;
+      for (size_t j=0; j<width; ++j) {
+        best[j] = Compute(in[j]);
+      }
+      for (size_t k=1; k<length; ++k) {
+        for (size_t j=0; j<width; ++j) {
+          best[j] = std::max(best[j], Compute(in[k * inner + j]));
+        }
+      }
+      for (size_t j=0; j<width; ++j) {
+        out[index + j] = T(best[j]);
+      }
+    });
+    return fromStorage(std::move(data), 0, std::move(shape));
+  }
+  // Index along 'axis' of the (first) maximum, for each element of the reduced shape in row-major order
+  std::vector<size_t> argmax(size_t axis) const {
+    const auto shape = reducedShape(axis, false);
+    if (_shape[axis] == 0) {
+      throw std::runtime_error("Maximum over an empty dimension");
+    }
+    std::vector<size_t> result(getSize(shape));
+    const auto out = result.data();
+    forAxisTiles(axis, [out](const T* in, size_t length, size_t inner, size_t width, size_t index) {
+      std::array<Compute, kernels::MaxColumns> best;
+      for (size_t j=0; j<width; ++j) {
+        best[j] = Compute(in[j]);
+        out[index + j] = 0;
+      }
+      for (size_t k=1; k<length; ++k) {
+        for (size_t j=0; j<width; ++j) {
+          const auto value = Compute(in[k * inner + j]);
+          if (value > best[j]) {
+            best[j] = value;
+            out[index + j] = k;
+          }
+        }
+      }
+    });
     return result;
   }
-  auto relu() {
-    return apply([](double d, size_t) { return d > 0.0 ? d : 0.0; });
+  // log(sum(exp(x))) along 'axis', shifted by the maximum so large inputs do not overflow
+  BasicTensor logsumexp(size_t axis, bool keepDims = false) const {
+    const auto m = max(axis, true);
+    auto result = (*this - m).apply([](Compute d, size_t) { return Compute(std::exp(d)); }).sum(axis, true);
+    result.apply_([](Compute d) { return Compute(std::log(d)); });
+    result += m;
+    return keepDims ? result : result.view(reducedShape(axis, false));
+  }
+  auto relu() const {
+    return apply([](Compute d, size_t) { return d > Compute(0) ? d : Compute(0); });
   }
-  auto power (double value) {
-    return apply([value](double d, size_t) { return std::pow(d, value); });
+  auto power (double value) const {
+    return apply([value = Compute(value)](Compute d, size_t) { return Compute(std::pow(d, value)); });
   }
 
-  bool operator<(const Tensor& other) const {
+  bool operator<(const BasicTensor& other) const {
     return sum() < other.sum();
   }
-  bool operator>(const Tensor& other) const {
+  bool operator>(const BasicTensor& other) const {
     return sum() > other.sum();
   }
-  bool operator<=(const Tensor& other) const {
+  bool operator<=(const BasicTensor& other) const {
     return sum() <= other.sum();
   }
 
-  // Add single element comparison operators
+  // Single element comparison operators
   bool operator<(double value) const {
-    assert(_data.size() == 1);
-    return sum() < value;
+    return element() < value;
   }
   bool operator>(double value) const {
-    assert(_data.size() == 1);
-    return sum() > value;
+    return element() > value;
   }
   bool operator<=(double value) const {
-    assert(_data.size() == 1);
-    return sum() <= value;
+    return element() <= value;
   }
   bool operator==(double value) const {
-    assert(_data.size() == 1);
-    return sum() == value;
+    return element() == value;
   }
   bool operator!=(double value) const {
-    assert(_data.size() == 1);
-    return sum() != value;
+    return element() != value;
   }
-};
\ No newline at end of file
+};
+
+using Tensor = BasicTensor<double>;
\ No newline at end of file
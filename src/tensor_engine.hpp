@@ -0,0 +1,252 @@
+#pragma once
+
+#include "engine.hpp"
+#include "profiler.hpp"
+#include "reduce.hpp"
+#include "tensor.hpp"
+
+enum class TensorOperation {
+  Null,
+  Addition,
+  Subtraction,
+  Multiplication,
+  MatrixMultiplication,
+  Power,
+  RELU,
+  Sum,
+  MeanSquaredError
+};
+
+std::string_view toString(TensorOperation op)
+{
+  switch (op)
+  {
+    case TensorOperation::Null: return "null";
+    case TensorOperation::Addition: return "+";
+    case TensorOperation::Subtraction: return "-";
+    case TensorOperation::Multiplication: return "*";
+    case TensorOperation::MatrixMultiplication: return "matmul";
+    case TensorOperation::Power: return "pow";
+    case TensorOperation::RELU: return "RELU";
+    case TensorOperation::Sum: return "sum";
+    case TensorOperation::MeanSquaredError: return "mse";
+  }
+
+  throw std::runtime_error("Unhandled op");
+}
+
+struct TensorValue;
+
+struct TensorInputs {
+  TensorOperation operation = TensorOperation::Null;
+  std::vector<std::shared_ptr<TensorValue>> values;
+  double power = 0.0;
+};
+
+// Note: do not construct directly, use TensorValue::make(...) as the
+// TensorValuePtr type has all the operators defined on it
+//
+// Tensor counterpart of Value: each node holds a whole Tensor and its gradient,
+// so an expression graph has one node per tensor operation rather than one per scalar.
+struct TensorValue {
+  Tensor _value;
+  TensorInputs _inputs;
+  // Allocated (zeroed) by backwards() for the nodes it reaches, so forward only
+  // (inference) graphs never allocate gradients; until then it has no storage
+  Tensor _grad;
+  uint64_t _visitEpoch = 0;
+
+  TensorValue(Tensor value, TensorInputs inputs = TensorInputs{})
+  : _value(std::move(value)), _inputs(std::move(inputs))
+  {}
+  TensorValue(const TensorValue&) = default;
+  TensorValue& operator=(const TensorValue&) = default;
+
+  // Iterative teardown of long graphs, as for Value
+  ~TensorValue() {
+    thread_local std::vector<std::shared_ptr<TensorValue>> pending;
+    thread_local bool draining = false;
+    for (auto& input : _inputs.values) {
+      pending.push_back(std::move(input));
+    }
+    if (draining) {
+      return;
+    }
+    draining = true;
+    while (!pending.empty()) {
+      auto next = std::move(pending.back());
+      pending.pop_back();
+    }
+    draining = false;
+  }
+
+  // Same iterative epoch-marking traversal as Value::buildTopo
+  static void buildTopo(std::vector<TensorValue*>& topo, TensorValue* root)
+  {
+    std::vector<std::pair<TensorValue*, size_t>> stack;
+    const auto epoch = Value::nextVisitEpoch();
+    root->_visitEpoch = epoch;
+    stack.push_back({ root, 0 });
+    while (!stack.empty()) {
+      auto& [value, next] = stack.back();
+      if (next < value->_inputs.values.size()) {
+        auto input = value->_inputs.values[next++].get();
+        if (input->_visitEpoch != epoch) {
+          input->_visitEpoch = epoch;
+          stack.push_back({ input, 0 });
+        }
+      } else {
+        topo.push_back(value);
+        stack.pop_back();
+      }
+    }
+  }
+
+  void zeroGrad() {
+    if (_grad.hasStorage()) {
+      _grad.fill_(0.0);
+    }
+  }
+
+  void backwardsOnce() {
+    auto& values = _inputs.values;
+    switch (_inputs.operation) {
+      case TensorOperation::Null:
+        break;
+      case TensorOperation::Addition:
+        // Operands may have been broadcast, so reduce the gradient back to their shape
+        values[0]->_grad += _grad.sumTo(values[0]->_value.shape());
+        values[1]->_grad += _grad.sumTo(values[1]->_value.shape());
+        break;
+      case TensorOperation::Subtraction:
+        values[0]->_grad += _grad.sumTo(values[0]->_value.shape());
+        values[1]->_grad -= _grad.sumTo(values[1]->_value.shape());
+        break;
+      case TensorOperation::Multiplication: {
+        auto& a = values[0];
+        auto& b = values[1];
+        a->_grad += (b->_value * _grad).sumTo(a->_value.shape());
+        b->_grad += (a->_value * _grad).sumTo(b->_value.shape());
+        break;
+      }
+      case TensorOperation::MatrixMultiplication: {
+        // C = A B: dA = dC Bt, dB = At dC
+        auto& a = values[0];
+        auto& b = values[1];
+        a->_grad += _grad.matmul(b->_value.transpose());
+        b->_grad += a->_value.transpose().matmul(_grad);
+        break;
+      }
+      case TensorOperation::Power: {
+        const auto p = _inputs.power;
+        auto& a = values[0];
+        a->_grad += a->_value.power(p-1) * p * _grad;
+        break;
+      }
+      case TensorOperation::RELU: {
+        const auto grad = _grad.contiguous();
+        const auto g = grad.data();
+        values[0]->_grad += _value.apply([g](double d, size_t i) {
+          return d > 0.0 ? g[i] : 0.0;
+        });
+        break;
+      }
+      case TensorOperation::Sum:
+        values[0]->_grad += _grad.element();
+        break;
+      case TensorOperation::MeanSquaredError: {
+        // d/da mean((a - b)^2) = 2 (a - b) / n
+        auto& a = values[0];
+        auto& b = values[1];
+        const auto scale = 2.0 * _grad.element() / double(a->_value.size());
+        const auto delta = (a->_value - b->_value) * scale;
+        a->_grad += delta;
+        b->_grad -= delta;
+        break;
+      }
+    }
+  }
+
+  void backwards()
+  {
+    std::vector<TensorValue*> topo;
+    {
+      profiler::Scope scope(profiler::Phase::TopoSort);
+      buildTopo(topo, this);
+    }
+    profiler::Scope scope(profiler::Phase::Backward);
+    _grad = Tensor::ones(_value.shape());
+    for (auto value : topo) {
+      if (!value->_grad.hasStorage()) {
+        value->_grad = Tensor::zeros(value->_value.shape());
+      }
+    }
+    std::for_each(std::rbegin(topo), std::rend(topo), [&](TensorValue* value) {
+      value->backwardsOnce();
+    });
+  }
+
+  template<typename... Args>
+  static auto make(Args&&... args)
+  {
+    return std::make_shared<TensorValue>(std::forward<Args>(args)...);
+  }
+};
+
+using TensorValuePtr = std::shared_ptr<TensorValue>;
+
+TensorValuePtr operator+(const TensorValuePtr& a, const TensorValuePtr& b)
+{
+  return TensorValue::make(a->_value + b->_value, TensorInputs{ TensorOperation::Addition, { a, b } });
+}
+TensorValuePtr operator-(const TensorValuePtr& a, const TensorValuePtr& b)
+{
+  return TensorValue::make(a->_value - b->_value, TensorInputs{ TensorOperation::Subtraction, { a, b } });
+}
+// Elementwise multiplication
+TensorValuePtr operator*(const TensorValuePtr& a, const TensorValuePtr& b)
+{
+  return TensorValue::make(a->_value * b->_value, TensorInputs{ TensorOperation::Multiplication, { a, b } });
+}
+TensorValuePtr matmul(const TensorValuePtr& a, const TensorValuePtr& b)
+{
+  return TensorValue::make(a->_value.matmul(b->_value), TensorInputs{ TensorOperation::MatrixMultiplication, { a, b } });
+}
+TensorValuePtr power(const TensorValuePtr& a, double value)
+{
+  return TensorValue::make(a->_value.power(value), TensorInputs{ TensorOperation::Power, { a }, value });
+}
+TensorValuePtr relu(const TensorValuePtr& a)
+{
+  return TensorValue::make(a->_value.relu(), TensorInputs{ TensorOperation::RELU, { a } });
+}
+// Reduces all elements into a single element tensor
+TensorValuePtr sum(const TensorValuePtr& a)
+{
+  return TensorValue::make(Tensor({ a->_value.sum() }, { 1 }), TensorInputs{ TensorOperation::Sum, { a } });
+}
+
+// Mean of the squared differences over every element, e.g. a [batch, outputs] prediction
+// against its targets, computed in a single pass into a single element tensor
+TensorValuePtr meanSquaredError(const TensorValuePtr& prediction, const TensorValuePtr& target)
+{
+  if (prediction->_value.shape() != target->_value.shape()) {
+    throw std::runtime_error("Prediction and target shapes do not match");
+  }
+  const auto a = prediction->_value.contiguous();
+  const auto b = target->_value.contiguous();
+  const auto lhs = a.data();
+  const auto rhs = b.data();
+  const auto total = kernels::pairwiseSum<double>(lhs.size(), [l = lhs.data(), r = rhs.data()](size_t i) {
+    const auto d = l[i] - r[i];
+    return d * d;
+  });
+  const auto mean = lhs.empty() ? 0.0 : total / double(lhs.size());
+  return TensorValue::make(Tensor({ mean }, { 1 }), TensorInputs{ TensorOperation::MeanSquaredError, { prediction, target } });
+}
+
+std::ostream& operator<<(std::ostream& os, const TensorValuePtr& value)
+{
+  os << value->_value;
+  return os;
+}
\ No newline at end of file
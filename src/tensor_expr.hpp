@@ -0,0 +1,142 @@
+#pragma once
+
+#include "tensor.hpp"
+#include <concepts>
+#include <type_traits>
+
+// Lazily evaluated elementwise Tensor arithmetic
+// The Tensor operators are eager: each one materializes its full result.
+// Wrapping an operand with expr::lazy(...) instead turns a chain of elementwise operations
+// into an expression object which is only evaluated once it is converted to a Tensor,
+// in a single pass with a single output allocation:
+//
+//   Tensor result = relu((expr::lazy(t1) + t2) * 2.0 - t3);
+//
+// Operands may be expressions, tensors or scalars, all tensor shapes must match.
+// An expression takes its shape from its tensors, so one of scalars only cannot be evaluated
+// (it does not convert to Tensor).
+namespace expr {
+
+struct ExpressionBase {};
+
+template<typename E>
+concept Expression = std::derived_from<std::remove_cvref_t<E>, ExpressionBase>;
+
+template<typename T>
+concept Operand = Expression<T> || std::same_as<std::remove_cvref_t<T>, Tensor> || std::is_arithmetic_v<std::remove_cvref_t<T>>;
+
+// Expressions with at least one tensor operand (Leaf), i.e. with a shape
+template<typename E>
+concept Shaped = Expression<E> && std::remove_cvref_t<E>::HasLeaf;
+
+// Base providing the conversion to Tensor, which evaluates the expression
+template<typename Derived>
+struct Evaluable : ExpressionBase {
+  operator Tensor() const requires Shaped<Derived> {
+    const auto& self = static_cast<const Derived&>(*this);
+    return Tensor::generate(self.shape(), [&self](size_t i) { return self[i]; });
+  }
+};
+
+// Reference to the elements of a tensor (kept contiguous so it can be indexed linearly)
+struct Leaf : Evaluable<Leaf> {
+  static constexpr bool HasLeaf = true;
+  Tensor tensor;
+  const double* values;
+
+  Leaf(const Tensor& t) : tensor(t.contiguous()), values(tensor.data().data()) {}
+  double operator[](size_t i) const { return values[i]; }
+  const std::vector<size_t>* shapePtr() const { return &tensor.shape(); }
+  const std::vector<size_t>& shape() const { return tensor.shape(); }
+};
+
+// Scalar broadcast to every element
+struct Scalar : Evaluable<Scalar> {
+  static constexpr bool HasLeaf = false;
+  double value;
+
+  Scalar(double v) : value(v) {}
+  double operator[](size_t) const { return value; }
+  const std::vector<size_t>* shapePtr() const { return nullptr; }
+};
+
+template<typename Op, typename E>
+struct Unary : Evaluable<Unary<Op, E>> {
+  static constexpr bool HasLeaf = E::HasLeaf;
+  E operand;
+  Op op;
+
+  Unary(E e, Op o) : operand(std::move(e)), op(o) {}
+  double operator[](size_t i) const { return op(operand[i]); }
+  const std::vector<size_t>* shapePtr() const { return operand.shapePtr(); }
+  const std::vector<size_t>& shape() const requires HasLeaf { return *shapePtr(); }
+};
+
+template<typename Op, typename L, typename R>
+struct Binary : Evaluable<Binary<Op, L, R>> {
+  static constexpr bool HasLeaf = L::HasLeaf || R::HasLeaf;
+  L lhs;
+  R rhs;
+  Op op;
+
+  Binary(L l, R r, Op o) : lhs(std::move(l)), rhs(std::move(r)), op(o) {
+    const auto a = lhs.shapePtr();
+    const auto b = rhs.shapePtr();
+    if (a && b && *a != *b) {
+      throw std::runtime_error("Expression operand shapes do not match");
+    }
+  }
+  double operator[](size_t i) const { return op(lhs[i], rhs[i]); }
+  const std::vector<size_t>* shapePtr() const {
+    const auto a = lhs.shapePtr();
+    return a ? a : rhs.shapePtr();
+  }
+  const std::vector<size_t>& shape() const requires HasLeaf { return *shapePtr(); }
+};
+
+// Expression node for any operand
+template<Expression E>
+auto toExpression(const E& e) { return e; }
+inline Leaf toExpression(const Tensor& t) { return Leaf(t); }
+inline Scalar toExpression(double d) { return Scalar(d); }
+
+inline Leaf lazy(const Tensor& t) { return Leaf(t); }
+
+template<typename Op, Operand A, Operand B>
+auto makeBinary(const A& a, const B& b, Op op) {
+  auto l = toExpression(a);
+  auto r = toExpression(b);
+  return Binary<Op, decltype(l), decltype(r)>(std::move(l), std::move(r), op);
+}
+
+template<Operand A, Operand B> requires (Expression<A> || Expression<B>)
+auto operator+(const A& a, const B& b) { return makeBinary(a, b, [](double x, double y) { return x + y; }); }
+template<Operand A, Operand B> requires (Expression<A> || Expression<B>)
+auto operator-(const A& a, const B& b) { return makeBinary(a, b, [](double x, double y) { return x - y; }); }
+template<Operand A, Operand B> requires (Expression<A> || Expression<B>)
+auto operator*(const A& a, const B& b) { return makeBinary(a, b, [](double x, double y) { return x * y; }); }
+template<Operand A, Operand B> requires (Expression<A> || Expression<B>)
+auto operator/(const A& a, const B& b) { return makeBinary(a, b, [](double x, double y) { return x / y; }); }
+
+template<Expression E>
+auto operator-(const E& e) {
+  auto op = [](double x) { return -x; };
+  return Unary<decltype(op), E>(e, op);
+}
+
+template<Expression E>
+auto relu(const E& e) {
+  auto op = [](double x) { return x > 0.0 ? x : 0.0; };
+  return Unary<decltype(op), E>(e, op);
+}
+
+template<Expression E>
+auto power(const E& e, double value) {
+  auto op = [value](double x) { return std::pow(x, value); };
+  return Unary<decltype(op), E>(e, op);
+}
+
+template<Shaped E>
+Tensor evaluate(const E& e) { return e; }
+
+}
\ No newline at end of file
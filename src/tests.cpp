@@ -1,3 +1,4 @@
+#include <array>
 #include <cstdlib>
 #include <iostream>
 #include <cassert>
@@ -5,6 +6,20 @@
 #include "engine.hpp"
 #include "nn.hpp"
 #include "tensor.hpp"
+#include "tensor_expr.hpp"
+#include "tape.hpp"
+#include "thread_pool.hpp"
+#include "optimizer.hpp"
+#include "compile.hpp"
+#include "trainer.hpp"
+#include "checkpoint.hpp"
+#include "dataset.hpp"
+#include "profiler.hpp"
+#include "memory_pool.hpp"
+#include "static_mlp.hpp"
+#include "inference_server.hpp"
+#include "quantize.hpp"
+#include <filesystem>
 
 void tensorTests()
 {
@@ -24,6 +39,27 @@ void tensorTests()
   assert((t[{1, 1}].element() == 4.0));
   assert((t[{ 1 }] == Tensor({ 3.0, 4.0 }, { 2 })));
 
+  // Indexing, reshaping and transposing are views onto the same storage
+  auto row = t[{ 1 }];
+  assert(row.sharesStorage(t) && row.isContiguous());
+  assert((t.view({ 4 }) == Tensor({ 1.0, 2.0, 3.0, 4.0 }, { 4 })));
+  auto tt = t.transpose();
+  assert(tt.sharesStorage(t) && !tt.isContiguous());
+  assert((tt[{ 0, 1 }].element() == 3.0));
+  assert((tt == Tensor({ 1.0, 3.0, 2.0, 4.0 }, { 2, 2 })));
+  auto compact = tt.contiguous();
+  assert(!compact.sharesStorage(t) && compact.isContiguous());
+  assert((t.contiguous().sharesStorage(t)));
+  assert((!t.clone().sharesStorage(t) && t.clone() == t));
+  assert(((tt + t) == Tensor({ 2.0, 5.0, 5.0, 8.0 }, { 2, 2 })));
+
+  Tensor rect({ 1.0, 2.0, 3.0, 4.0, 5.0, 6.0 }, { 2, 3 });
+  assert((rect[{1, 0}].element() == 4.0));
+  assert((rect.transpose() == Tensor({ 1.0, 4.0, 2.0, 5.0, 3.0, 6.0 }, { 3, 2 })));
+  assert((rect.matmul(rect.transpose()) == Tensor({ 14.0, 32.0, 32.0, 77.0 }, { 2, 2 })));
+  auto big = Tensor::random({ 200, 150 });
+  assert((big.transpose().matmul(big) == big.transpose().contiguous().matmul(big)));
+
   Tensor t1(
     { 1.0, 2.0,
     3.0, 4.0 }, { 2, 2 });
@@ -52,6 +88,20 @@ void tensorTests()
   auto t8 = t6.matmul(t7);
   assert((t8[{0, 0}].element() == 1000.0));
 
+  // Blocked kernel against the reference loop, covering edge tiles and multiple cache blocks
+  // Small integer values keep every partial sum exact regardless of summation order
+  for (auto [m, n, k] : std::vector<std::array<size_t, 3>>{
+    { 1, 1, 1 }, { 7, 3, 5 }, { 1, 1000, 300 }, { 300, 1, 17 }, { 97, 130, 600 }, { 13, 2100, 3 } }) {
+    std::vector<double> a(m*k);
+    std::vector<double> b(k*n);
+    std::generate(a.begin(), a.end(), []() { return double(rand() % 7) - 3.0; });
+    std::generate(b.begin(), b.end(), []() { return double(rand() % 7) - 3.0; });
+    std::vector<double> expected(m*n, 0.0);
+    kernels::gemmReference(m, n, k, a.data(), k, b.data(), n, expected.data(), n);
+    auto actual = Tensor(a, { m, k }).matmul(Tensor(b, { k, n }));
+    assert((actual == Tensor(expected, { m, n })));
+  }
+
   auto t9 = Tensor::ones({ 2, 2 });
   auto t10 = t9.relu();
   assert((t10[{0, 0}].element() == 1.0));
@@ -66,6 +116,167 @@ void tensorTests()
 
   auto t15 = Tensor({ 1.0 }, { 1 });
   assert((t15 < 2.0));
+
+  // Broadcasting: a [1, n] bias over the rows of a [batch, n] matrix
+  auto rows = Tensor({ 1.0, 2.0, 3.0, 4.0, 5.0, 6.0 }, { 2, 3 });
+  auto bias = Tensor({ 10.0, 20.0, 30.0 }, { 1, 3 });
+  assert((rows + bias == Tensor({ 11.0, 22.0, 33.0, 14.0, 25.0, 36.0 }, { 2, 3 })));
+  assert((rows * Tensor({ 2.0, 3.0 }, { 2, 1 }) == Tensor({ 2.0, 4.0, 6.0, 12.0, 15.0, 18.0 }, { 2, 3 })));
+  assert((Tensor::broadcastShape({ 4, 1, 3 }, { 2, 1 }) == std::vector<size_t>{ 4, 2, 3 }));
+  assert(((rows + bias).sumTo({ 1, 3 }) == Tensor({ 25.0, 47.0, 69.0 }, { 1, 3 })));
+  bool threw = false;
+  try {
+    rows + Tensor::ones({ 2, 2 });
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  assert(threw);
+
+  // In-place operators write through views into the shared storage
+  auto inPlace = rows.clone();
+  inPlace += bias;
+  inPlace -= 10.0;
+  assert((inPlace == Tensor({ 1.0, 12.0, 23.0, 4.0, 15.0, 26.0 }, { 2, 3 })));
+  auto square = Tensor({ 1.0, 2.0, 3.0, 4.0 }, { 2, 2 });
+  auto transposed = square.transpose();
+  transposed *= Tensor({ 1.0, 10.0 }, { 1, 2 });
+  assert((square == Tensor({ 1.0, 2.0, 30.0, 40.0 }, { 2, 2 })));
+  transposed += square;
+  assert((square == Tensor({ 2.0, 32.0, 32.0, 80.0 }, { 2, 2 })));
+  auto signs = Tensor({ -1.0, 2.0, -3.0, 4.0 }, { 2, 2 });
+  signs.relu_();
+  assert((signs == Tensor({ 0.0, 2.0, 0.0, 4.0 }, { 2, 2 })));
+  signs.fill_(3.0).power_(2.0);
+  assert((signs == Tensor::fill({ 2, 2 }, 9.0)));
+}
+
+void scalarTypeTests()
+{
+  assert(float(float16(1.0f)) == 1.0f);
+  assert(float(float16(-2.5f)) == -2.5f);
+  assert(float(float16(65504.0f)) == 65504.0f);
+  assert(float16(70000.0f).bits == 0x7c00);
+  assert(float(float16(std::ldexp(1.0f, -24))) == std::ldexp(1.0f, -24));
+  assert(float(float16(1.0f + std::ldexp(1.0f, -11))) == 1.0f);
+  assert(float(bfloat16(1.0f)) == 1.0f);
+  assert(float(bfloat16(3.140625f)) == 3.140625f);
+  assert(float(bfloat16(257.0f)) == 256.0f);
+
+  // Reduced precision tensors accumulate in float: summing in bfloat16 would stall at 256
+  const auto bones = BasicTensor<bfloat16>::ones({ 1000 });
+  assert(bones.sum() == 1000.0f);
+  const auto bproduct = BasicTensor<bfloat16>::ones({ 40, 600 }).matmul(BasicTensor<bfloat16>::ones({ 600, 30 }));
+  assert((bproduct[{ 39, 29 }].element() == 600.0f));
+  const auto hproduct = BasicTensor<float16>({ 1.0f, 2.0f, 3.0f, 4.0f }, { 2, 2 }).matmul(BasicTensor<float16>({ 5.0f, 6.0f, 7.0f, 8.0f }, { 2, 2 }));
+  assert((hproduct == BasicTensor<float16>({ 19.0f, 22.0f, 43.0f, 50.0f }, { 2, 2 })));
+  assert(((BasicTensor<float16>::fill({ 2 }, 2.0) * 3.0).relu().sum() == 12.0f));
+
+  const auto fa = BasicTensor<float>::random({ 70, 90 });
+  const auto fb = BasicTensor<float>::random({ 90, 50 });
+  std::vector<float> expected(70 * 50, 0.0f);
+  kernels::gemmReference(70, 50, 90, fa.data().data(), 90, fb.data().data(), 50, expected.data(), 50);
+  const auto fproduct = fa.matmul(fb);
+  for (size_t i=0; i<expected.size(); ++i) {
+    assert(std::abs(fproduct.data()[i] - expected[i]) < 1e-4f);
+  }
+
+  // Single precision engine
+  using FloatValue = BasicValue<float>;
+  auto a = FloatValue::make(2.0f);
+  auto b = FloatValue::make(-3.0f);
+  auto L = (a * b + FloatValue::make(10.0f)) * FloatValue::make(2.0f);
+  auto result = relu(power(L, -1));
+  result->backwards();
+  assert(result->_value == 0.125f);
+  assert(L->_grad == -0.015625f);
+  assert(a->_grad == 0.09375f);
+
+  auto mlp = BasicMultilayerPerceptron<BasicValuePtr<float>>({ 3, 4, 1 });
+  auto out = mlp({ FloatValue::make(1.0f), FloatValue::make(2.0f), FloatValue::make(3.0f) });
+  static_assert(std::is_same_v<decltype(out.front()->_value), float>);
+  assert(out.size() == 1 && mlp.parameters().size() == 4 * 4 + 1 * 5);
+}
+
+void tensorExprTests()
+{
+  Tensor t1({ 1.0, 2.0, 3.0, 4.0 }, { 2, 2 });
+  Tensor t2({ 5.0, 6.0, 7.0, 8.0 }, { 2, 2 });
+  Tensor t3({ 20.0, 1.0, 1.0, 1.0 }, { 2, 2 });
+
+  Tensor fused = (expr::lazy(t1) + t2) * 2.0 - t3;
+  assert((fused == (t1 + t2) * 2.0 - t3));
+  assert((fused == Tensor({ -8.0, 15.0, 19.0, 23.0 }, { 2, 2 })));
+
+  Tensor activated = relu(power(expr::lazy(t1) - 2.0, 2.0) - t1 / expr::lazy(t2));
+  assert((activated == ((t1 - 2.0).power(2.0) - t1 / t2).relu()));
+
+  // Operands may be transposed views, scalars may appear on either side
+  auto negated = expr::evaluate(-(1.0 - expr::lazy(t1.transpose())));
+  assert((negated == Tensor({ 0.0, 2.0, 1.0, 3.0 }, { 2, 2 })));
+
+  // Scalar only expressions have no shape to evaluate to, which is rejected at compile time
+  using ScalarOnly = decltype(relu(expr::Scalar(1.0) + 2.0));
+  static_assert(!expr::Shaped<ScalarOnly> && !std::is_convertible_v<ScalarOnly, Tensor>);
+  static_assert(expr::Shaped<decltype(expr::Scalar(1.0) + t1)>);
+
+  bool threw = false;
+  try {
+    Tensor mismatched = expr::lazy(t1) + Tensor::ones({ 4 });
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  assert(threw);
+}
+
+void threadPoolTests()
+{
+  ThreadPool pool(4);
+  assert(pool.size() == 4);
+
+  std::vector<int> hits(100000, 0);
+  pool.parallelFor(0, hits.size(), 1000, [&](size_t begin, size_t end) {
+    for (auto i=begin; i<end; ++i) {
+      ++hits[i];
+    }
+  });
+  assert(std::all_of(hits.begin(), hits.end(), [](int h) { return h == 1; }));
+
+  // Nested parallel loops make progress since the caller takes part
+  std::atomic<size_t> total{0};
+  pool.parallelFor(0, 8, 1, [&](size_t begin, size_t end) {
+    for (auto i=begin; i<end; ++i) {
+      pool.parallelFor(0, 1000, 10, [&](size_t b, size_t e) { total += e - b; });
+    }
+  });
+  assert(total == 8000);
+
+  // Every chunk is non-empty and within the range, also when the chunk count is capped
+  for (size_t threads : { 1, 2 }) {
+    ThreadPool small(threads);
+    for (size_t count=1; count<=40; ++count) {
+      for (size_t grain : { 1, 3 }) {
+        std::atomic<size_t> covered{0};
+        small.parallelFor(10, 10 + count, grain, [&](size_t b, size_t e) {
+          assert(b < e && b >= 10 && e <= 10 + count);
+          covered += e - b;
+        });
+        assert(covered == count);
+      }
+    }
+  }
+
+  // Tensor operations give the same results on any number of threads
+  auto a = Tensor::random({ 300, 400 });
+  auto b = Tensor::random({ 400, 500 });
+  ThreadPool::setGlobalThreadCount(1);
+  const auto serialProduct = a.matmul(b);
+  const auto serialSum = serialProduct.sum();
+  const auto serialRelu = (serialProduct - 100.0).relu();
+  ThreadPool::setGlobalThreadCount(4);
+  assert(a.matmul(b) == serialProduct);
+  assert(serialProduct.sum() == serialSum);
+  assert((serialProduct - 100.0).relu() == serialRelu);
+  ThreadPool::setGlobalThreadCount(std::thread::hardware_concurrency());
 }
 
 void engineTests()
@@ -86,6 +297,31 @@ void engineTests()
   assert(L->_value == 8.0);
   assert(L->_grad == -0.015625);
   assert(a->_grad == 0.09375);
+
+  // Fused operations: one node each, with their own backward rules
+  auto x = Value::make(3.0);
+  auto y = Value::make(-2.0);
+  auto z = Value::make(4.0);
+  auto difference = x - y;
+  auto quotient = x / y;
+  auto accumulated = multiplyAdd(x, y, z);
+  auto error = squaredError(x, y);
+  assert(difference->_value == 5.0 && quotient->_value == -1.5 && accumulated->_value == -2.0 && error->_value == 25.0);
+  assert(difference->_inputs.values.size() == 2 && accumulated->_inputs.values.size() == 3);
+  auto total = ((difference + quotient) + accumulated) + error;
+  total->backwards();
+  // d/dx = 1 + 1/y + y + 2(x - y), d/dy = -1 - x/y^2 + x - 2(x - y), d/dz = 1
+  assert(x->_grad == 1.0 - 0.5 - 2.0 + 10.0);
+  assert(y->_grad == -1.0 - 0.75 + 3.0 - 10.0);
+  assert(z->_grad == 1.0);
+
+  // A neuron adds one node per input
+  auto neuronInputs = std::vector<ValuePtr>{ Value::make(1.0), Value::make(2.0), Value::make(3.0) };
+  auto layer = Layer(3, 1);
+  auto output = layer(neuronInputs).front();
+  std::vector<Value*> topo;
+  Value::buildTopo(topo, output.get());
+  assert(topo.size() == 3 + 3 + 1 + 3);
 }
 
 auto print = [](auto& v) {
@@ -97,13 +333,1201 @@ auto print = [](auto& v) {
 };
 
 auto checkLoss = [](auto& actual, auto& predicted) {
-  auto result = Value::make(0.0);
+  auto result = ValueTraits<std::decay_t<decltype(actual[0])>>::make(0.0);
   for (size_t i=0; i<actual.size(); ++i) {
-    result = result + power((actual[i] - predicted[i]), 2.0);
+    result = result + squaredError(actual[i], predicted[i]);
   }
   return result;
 };
 
+void topoTests()
+{
+  // Deep linear chain, as produced by summing a loss over many samples
+  GraphArena arena;
+  std::vector<Value*> topo;
+  auto x = Value::make(2.0);
+  for (size_t i=0; i<3; ++i) {
+    {
+      GraphArena::Scope scope(arena);
+      auto result = Value::make(0.0);
+      for (size_t j=0; j<200000; ++j) {
+        result = result + x * x;
+      }
+      x->_grad = 0.0;
+      if (topo.empty()) {
+        Value::buildTopo(topo, result.get());
+      }
+      // Same structure rebuilt in a reset arena: the cached order is reused
+      assert(topo.back() == result.get());
+      result->backwards(topo);
+      assert(result->_value == 800000.0);
+      assert(x->_grad == 800000.0);
+    }
+    arena.reset();
+  }
+  assert(topo.size() == 400002);
+
+  // Dropping the last handle to a deep heap allocated chain does not recurse
+  {
+    auto result = Value::make(0.0);
+    for (size_t j=0; j<1000000; ++j) {
+      result = result + x;
+    }
+    auto tensorResult = TensorValue::make(Tensor({ 0.0 }, { 1 }));
+    const auto one = TensorValue::make(Tensor({ 1.0 }, { 1 }));
+    for (size_t j=0; j<200000; ++j) {
+      tensorResult = tensorResult + one;
+    }
+  }
+  // Nor does one where each node uses its input twice (the last reference is shared by both slots)
+  {
+    auto result = Value::make(1.0);
+    for (size_t j=0; j<1000000; ++j) {
+      result = result * result;
+    }
+    auto tensorResult = TensorValue::make(Tensor({ 1.0 }, { 1 }));
+    for (size_t j=0; j<200000; ++j) {
+      tensorResult = tensorResult + tensorResult;
+    }
+  }
+
+  // Shared sub-expressions are only visited once
+  auto a = Value::make(3.0);
+  auto b = a * a;
+  auto c = b + b;
+  std::vector<Value*> order;
+  Value::buildTopo(order, c.get());
+  assert(order.size() == 3);
+  assert(order.front() == a.get() && order.back() == c.get());
+  c->backwards();
+  assert(a->_grad == 12.0);
+}
+
+void arenaTests()
+{
+  GraphArena arena;
+  {
+    GraphArena::Scope scope(arena);
+    auto a = Value::make(2.0);
+    auto b = Value::make(-3.0);
+    auto c = Value::make(10.0);
+    auto L = (a * b + c) * Value::make(2.0);
+    auto reluResult = relu(power(L, -1));
+    reluResult->backwards();
+
+    assert(arena.size() == 9);
+    assert(a.use_count() == 0);
+    assert(reluResult->_value == 0.125);
+    assert(L->_grad == -0.015625);
+    assert(a->_grad == 0.09375);
+  }
+  arena.reset();
+  assert(arena.size() == 0);
+
+  // Outside of a scope nodes are heap allocated again
+  auto heap = Value::make(1.0) + Value::make(2.0);
+  assert(heap.use_count() == 1);
+  assert(arena.size() == 0);
+
+  // Parameters live on the heap, per-step graphs in the arena
+  auto xs = std::vector<std::vector<ValuePtr>>{
+    { Value::make(2.0), Value::make(3.0), Value::make(-1.0) },
+    { Value::make(3.0), Value::make(-1.0), Value::make(0.5)},
+  };
+  auto ys = std::vector<ValuePtr>{ Value::make(1.0), Value::make(-1.0) };
+  auto mlp = MultilayerPerceptron({ 3, 4, 4, 1 });
+  auto params = mlp.parameters();
+  size_t capacity = 0;
+  for (size_t i=0; i<100; ++i) {
+    {
+      GraphArena::Scope scope(arena);
+      auto ypred = std::vector<ValuePtr>{};
+      for (auto& x : xs) {
+        ypred.push_back(mlp(x).front());
+      }
+      auto loss = checkLoss(ys, ypred);
+      for (auto p : params) {
+        p->_grad = 0.0;
+      }
+      loss->backwards();
+      for (auto p : params) {
+        p->_value -= (0.0001 * p->_grad);
+      }
+    }
+    if (i == 0) {
+      capacity = arena.capacity();
+    }
+    arena.reset();
+  }
+  assert(arena.capacity() == capacity);
+}
+
+void tapeTests()
+{
+  Tape tape;
+  {
+    Tape::Scope scope(tape);
+    auto a = TapeValue::make(2.0);
+    auto b = TapeValue::make(-3.0);
+    auto c = TapeValue::make(10.0);
+    auto L = (a * b + c) * TapeValue::make(2.0);
+    auto reluResult = relu(power(L, -1));
+    reluResult->backwards();
+
+    assert(reluResult->_value == 0.125);
+    assert(L->_value == 8.0);
+    assert(L->_grad == -0.015625);
+    assert(a->_grad == 0.09375);
+  }
+  tape.clear();
+  {
+    // Same fused operations as engineTests
+    Tape::Scope scope(tape);
+    auto x = TapeValue::make(3.0);
+    auto y = TapeValue::make(-2.0);
+    auto z = TapeValue::make(4.0);
+    auto total = (((x - y) + x / y) + multiplyAdd(x, y, z)) + squaredError(x, y);
+    total->backwards();
+    assert(total->_value == 5.0 - 1.5 - 2.0 + 25.0);
+    assert(x->_grad == 1.0 - 0.5 - 2.0 + 10.0);
+    assert(y->_grad == -1.0 - 0.75 + 3.0 - 10.0);
+    assert(z->_grad == 1.0);
+  }
+  tape.clear();
+
+  // Same network and training loop as nnTests2, recorded on the tape
+  // Data and parameters are recorded first and kept, each step truncates back to them
+  Tape::Scope scope(tape);
+  auto xs = std::vector<std::vector<TapeValue>>{
+    { TapeValue::make(2.0), TapeValue::make(3.0), TapeValue::make(-1.0) },
+    { TapeValue::make(3.0), TapeValue::make(-1.0), TapeValue::make(0.5)},
+    { TapeValue::make(0.5), TapeValue::make(1.0), TapeValue::make(1.0) },
+    { TapeValue::make(1.0), TapeValue::make(1.0), TapeValue::make(-1.0) }
+  };
+  auto ys = std::vector<TapeValue>{
+    TapeValue::make(1.0), TapeValue::make(-1.0), TapeValue::make(-1.0), TapeValue::make(1.0)
+  };
+  auto mlp = BasicMultilayerPerceptron<TapeValue>({ 3, 4, 4, 1 });
+  auto params = mlp.parameters();
+  const auto mark = tape.size();
+  double firstLoss = 0.0;
+  double lastLoss = 0.0;
+  for (size_t i=0; i<1000; ++i) {
+    tape.truncate(mark);
+    auto ypred = std::vector<TapeValue>{};
+    for (auto& x : xs) {
+      ypred.push_back(mlp(x).front());
+    }
+    auto loss = checkLoss(ys, ypred);
+    lastLoss = loss->_value;
+    if (i == 0) {
+      firstLoss = lastLoss;
+    }
+    for (auto p : params) {
+      p->_grad = 0.0;
+    }
+    loss->backwards();
+    for (auto p : params) {
+      p->_value -= (0.0001 * p->_grad);
+    }
+  }
+  assert(lastLoss <= firstLoss);
+}
+
+void tensorEngineTests()
+{
+  // Same expression as engineTests on 1x1 tensors
+  auto scalar = [](double d) { return TensorValue::make(Tensor({ d }, { 1, 1 })); };
+  auto a = scalar(2.0);
+  auto b = scalar(-3.0);
+  auto L = (a * b + scalar(10.0)) * scalar(2.0);
+  auto result = relu(power(L, -1));
+  // Gradients are only allocated once backwards() reaches a node
+  assert(!L->_grad.hasStorage() && !a->_grad.hasStorage());
+  result->backwards();
+  assert(result->_value.element() == 0.125);
+  assert(L->_grad.element() == -0.015625);
+  assert(a->_grad.element() == 0.09375);
+
+  // d(sum(x W))/dW = xt 1, d(sum(x W))/dx = 1 Wt
+  auto x = TensorValue::make(Tensor({ 1.0, 2.0 }, { 1, 2 }));
+  auto W = TensorValue::make(Tensor({ 1.0, 2.0, 3.0, 4.0, 5.0, 6.0 }, { 2, 3 }));
+  auto y = sum(matmul(x, W));
+  y->backwards();
+  assert(y->_value.element() == 9.0 + 12.0 + 15.0);
+  assert((W->_grad == Tensor({ 1.0, 1.0, 1.0, 2.0, 2.0, 2.0 }, { 2, 3 })));
+  assert((x->_grad == Tensor({ 6.0, 15.0 }, { 1, 2 })));
+
+  // Train on the nnTests2 data
+  auto xs = std::vector<TensorValuePtr>{
+    TensorValue::make(Tensor({ 2.0, 3.0, -1.0 }, { 1, 3 })),
+    TensorValue::make(Tensor({ 3.0, -1.0, 0.5 }, { 1, 3 })),
+    TensorValue::make(Tensor({ 0.5, 1.0, 1.0 }, { 1, 3 })),
+    TensorValue::make(Tensor({ 1.0, 1.0, -1.0 }, { 1, 3 }))
+  };
+  auto ys = std::vector<TensorValuePtr>{ scalar(1.0), scalar(-1.0), scalar(-1.0), scalar(1.0) };
+  auto mlp = TensorMultilayerPerceptron({ 3, 4, 4, 1 });
+  auto params = mlp.parameters();
+  double firstLoss = 0.0;
+  double lastLoss = 0.0;
+  for (size_t i=0; i<1000; ++i) {
+    auto loss = scalar(0.0);
+    for (size_t j=0; j<xs.size(); ++j) {
+      loss = loss + power(mlp(xs[j]) - ys[j], 2.0);
+    }
+    lastLoss = loss->_value.element();
+    if (i == 0) {
+      firstLoss = lastLoss;
+    }
+    for (auto p : params) {
+      p->zeroGrad();
+    }
+    loss->backwards();
+    for (auto p : params) {
+      p->_value -= p->_grad * 0.001;
+    }
+  }
+  assert(lastLoss <= firstLoss);
+
+  // A batch of rows through one layer: the bias gradient is summed over the batch
+  auto layer = TensorLayer(3, 2, false);
+  auto batch = TensorValue::make(Tensor({ 2.0, 3.0, -1.0, 3.0, -1.0, 0.5, 0.5, 1.0, 1.0 }, { 3, 3 }));
+  auto out = layer(batch);
+  assert((out->_value.shape() == std::vector<size_t>{ 3, 2 }));
+  sum(out)->backwards();
+  const auto bias = layer.parameters()[1];
+  assert((bias->_grad == Tensor({ 3.0, 3.0 }, { 1, 2 })));
+  assert((layer.parameters()[0]->_grad == Tensor({ 5.5, 5.5, 3.0, 3.0, 0.5, 0.5 }, { 3, 2 })));
+
+  // The loss over a batch is a single node: d/dp mean((p - t)^2) = 2 (p - t) / n
+  auto prediction = TensorValue::make(Tensor({ 1.0, 2.0, 3.0, 4.0 }, { 4, 1 }));
+  auto target = TensorValue::make(Tensor({ 1.0, 0.0, 3.0, 2.0 }, { 4, 1 }));
+  auto mse = meanSquaredError(prediction, target);
+  assert(mse->_value.element() == 2.0);
+  mse->backwards();
+  assert((prediction->_grad == Tensor({ 0.0, 1.0, 0.0, 1.0 }, { 4, 1 })));
+  assert((target->_grad == Tensor({ 0.0, -1.0, 0.0, -1.0 }, { 4, 1 })));
+
+  // Mini-batch training: one forward/backward per step over all the nnTests2 samples
+  auto inputs = Tensor({ 2.0, 3.0, -1.0, 3.0, -1.0, 0.5, 0.5, 1.0, 1.0, 1.0, 1.0, -1.0 }, { 4, 3 });
+  auto targets = Tensor({ 1.0, -1.0, -1.0, 1.0 }, { 4, 1 });
+  auto batched = TensorMultilayerPerceptron({ 3, 4, 4, 1 });
+  auto batchedParams = batched.parameters();
+  double firstBatchLoss = 0.0;
+  double lastBatchLoss = 0.0;
+  for (size_t i=0; i<1000; ++i) {
+    for (auto p : batchedParams) {
+      p->zeroGrad();
+    }
+    lastBatchLoss = batched.backwards(inputs, targets);
+    if (i == 0) {
+      firstBatchLoss = lastBatchLoss;
+    }
+    for (auto p : batchedParams) {
+      p->_value -= p->_grad * 0.01;
+    }
+  }
+  assert(lastBatchLoss <= firstBatchLoss);
+  assert((batched(inputs)->_value.shape() == std::vector<size_t>{ 4, 1 }));
+}
+
+void optimizerTests()
+{
+  // Minimize sum((p - 3)^2), the gradient being 2 (p - 3)
+  auto minimize = [](auto& optimizer, size_t steps) {
+    ParameterBuffer buffer(5);
+    for (size_t step=0; step<steps; ++step) {
+      auto values = buffer.values();
+      auto grads = buffer.grads();
+      for (size_t i=0; i<buffer.size(); ++i) {
+        grads[i] += 2.0 * (values[i] - 3.0);
+      }
+      optimizer.step(buffer);
+      // The update also zeroes the gradients
+      assert(std::all_of(grads.begin(), grads.end(), [](double g) { return g == 0.0; }));
+    }
+    return buffer.values()[0];
+  };
+  auto sgd = SGD(0.1);
+  assert(std::abs(minimize(sgd, 100) - 3.0) < 1e-6);
+  auto momentum = SGD(0.05, 0.9);
+  assert(std::abs(minimize(momentum, 300) - 3.0) < 1e-6);
+  auto adam = Adam(0.1);
+  assert(std::abs(minimize(adam, 1000) - 3.0) < 1e-3);
+
+  // Adam's first step moves each parameter by the learning rate against the gradient's sign
+  std::vector<double> values{ 1.0, 1.0 };
+  std::vector<double> grads{ 4.0, -0.5 };
+  Adam(0.01).step(values, grads);
+  assert(std::abs(values[0] - 0.99) < 1e-9 && std::abs(values[1] - 1.01) < 1e-9);
+
+  // Decoupled weight decay shrinks parameters even without gradient
+  std::vector<double> decayed{ 2.0 };
+  std::vector<double> none{ 0.0 };
+  AdamW(0.1, 0.5).step(decayed, none);
+  assert(std::abs(decayed[0] - 1.9) < 1e-12);
+
+  // Tensor parameters are views into the model's buffer
+  auto mlp = TensorMultilayerPerceptron({ 3, 4, 1 });
+  auto& buffer = mlp.parameterBuffer();
+  assert(buffer.size() == (3 + 1) * 4 + (4 + 1) * 1);
+  auto inputs = Tensor({ 2.0, 3.0, -1.0, 3.0, -1.0, 0.5, 0.5, 1.0, 1.0, 1.0, 1.0, -1.0 }, { 4, 3 });
+  auto targets = Tensor({ 1.0, -1.0, -1.0, 1.0 }, { 4, 1 });
+  auto optimizer = AdamW(0.01);
+  const auto firstLoss = mlp.backwards(inputs, targets);
+  optimizer.step(buffer);
+  double lastLoss = firstLoss;
+  for (size_t i=0; i<500; ++i) {
+    lastLoss = mlp.backwards(inputs, targets);
+    optimizer.step(buffer);
+  }
+  assert(lastLoss < firstLoss);
+  for (auto p : mlp.parameters()) {
+    assert(p->_grad.sum() == 0.0);
+  }
+
+  // The tape's parameters are its first entries
+  Tape tape;
+  Tape::Scope scope(tape);
+  auto x = TapeValue::make(0.0);
+  const auto mark = tape.size();
+  auto optimizerOnTape = SGD(0.1);
+  for (size_t i=0; i<100; ++i) {
+    tape.truncate(mark);
+    power(x - TapeValue::make(3.0), 2.0)->backwards();
+    optimizerOnTape.step(tape.values().first(mark), tape.grads().first(mark));
+  }
+  assert(std::abs(x->_value - 3.0) < 1e-6);
+}
+
+void compileTests()
+{
+  // Constants are folded: x - (2 * 3) is a single 'add constant' step
+  auto x = Value::make(1.0);
+  auto y = Value::make(4.0);
+  auto folded = CompiledGraph::trace(x - Value::make(2.0) * Value::make(3.0), {}, std::vector<ValuePtr>{ x });
+  assert(folded.size() == 1 && folded.forward() == -5.0);
+  // x * y - y with y an input and x a parameter: nothing to fold, a plan of two steps (multiply, subtract)
+  auto product = CompiledGraph::trace(x * y - y, std::vector<ValuePtr>{ y }, std::vector<ValuePtr>{ x });
+  assert(product.size() == 2);
+  // x / 4: the division by a constant is folded into a multiplication by its reciprocal
+  assert(CompiledGraph::trace(x / Value::make(4.0), {}, std::vector<ValuePtr>{ x }).forward() == 0.25);
+  product.setInput(0, 10.0);
+  assert(product.forward() == 0.0);
+  x->_grad = 0.0;
+  product.backwards();
+  assert(x->_grad == 10.0);
+
+  // Replaying a traced training step matches rebuilding the graph
+  auto xs = std::vector<std::vector<ValuePtr>>{
+    { Value::make(2.0), Value::make(3.0), Value::make(-1.0) },
+    { Value::make(3.0), Value::make(-1.0), Value::make(0.5)},
+    { Value::make(0.5), Value::make(1.0), Value::make(1.0) },
+    { Value::make(1.0), Value::make(1.0), Value::make(-1.0) }
+  };
+  auto ys = std::vector<ValuePtr>{
+    Value::make(1.0), Value::make(-1.0), Value::make(-1.0), Value::make(1.0)
+  };
+  auto mlp = MultilayerPerceptron({ 3, 4, 4, 1 });
+  const auto params = mlp.parameters();
+  auto lossOf = [&]() {
+    auto ypred = std::vector<ValuePtr>{};
+    for (auto& sample : xs) {
+      ypred.push_back(mlp(sample).front());
+    }
+    return checkLoss(ys, ypred);
+  };
+  std::vector<ValuePtr> inputs;
+  for (auto& sample : xs) {
+    inputs.insert(inputs.end(), sample.begin(), sample.end());
+  }
+  auto compiled = CompiledGraph::trace(lossOf(), inputs, params);
+  assert(compiled.numberOfInputs() == 12);
+
+  auto zeroGrads = [&]() {
+    for (auto p : params) {
+      p->_grad = 0.0;
+    }
+  };
+  double firstLoss = 0.0;
+  double lastLoss = 0.0;
+  for (size_t i=0; i<100; ++i) {
+    // New inputs only need to be written into the plan's slots
+    const auto scale = 1.0 + 0.001 * double(i);
+    for (size_t j=0; j<inputs.size(); ++j) {
+      compiled.setInput(j, inputs[j]->_value * scale);
+    }
+    const auto replayed = compiled.forward();
+    zeroGrads();
+    compiled.backwards();
+    std::vector<double> replayedGrads;
+    for (auto p : params) {
+      replayedGrads.push_back(p->_grad);
+    }
+
+    for (auto& input : inputs) {
+      input->_value *= scale;
+    }
+    auto loss = lossOf();
+    assert(std::abs(loss->_value - replayed) < 1e-9);
+    zeroGrads();
+    loss->backwards();
+    for (size_t j=0; j<params.size(); ++j) {
+      assert(std::abs(params[j]->_grad - replayedGrads[j]) < 1e-9);
+    }
+    for (auto& input : inputs) {
+      input->_value /= scale;
+    }
+
+    lastLoss = replayed;
+    if (i == 0) {
+      firstLoss = lastLoss;
+    }
+    for (auto p : params) {
+      p->_value -= (0.001 * p->_grad);
+    }
+  }
+  assert(lastLoss <= firstLoss);
+}
+
+void parallelBackwardTests()
+{
+  // A loss summed over many samples: the per-sample branches only meet at the shared parameters
+  auto mlp = MultilayerPerceptron({ 3, 4, 1 });
+  const auto params = mlp.parameters();
+  std::vector<ValuePtr> ys;
+  std::vector<ValuePtr> ypred;
+  for (size_t i=0; i<1000; ++i) {
+    auto x = std::vector<ValuePtr>{ Value::make(double(i % 7) - 3.0), Value::make(double(i % 5) - 2.0), Value::make(1.0) };
+    ys.push_back(Value::make(i % 2 ? 1.0 : -1.0));
+    ypred.push_back(mlp(x).front());
+  }
+  // Pairwise sum so that the graph is wide rather than one deep chain
+  std::vector<ValuePtr> terms;
+  for (size_t i=0; i<ys.size(); ++i) {
+    terms.push_back(squaredError(ys[i], ypred[i]));
+  }
+  while (terms.size() > 1) {
+    std::vector<ValuePtr> sums;
+    for (size_t i=0; i+1<terms.size(); i+=2) {
+      sums.push_back(terms[i] + terms[i+1]);
+    }
+    if (terms.size() % 2) {
+      sums.push_back(terms.back());
+    }
+    terms = std::move(sums);
+  }
+  auto loss = terms.front();
+
+  loss->backwards();
+  std::vector<Value*> topo;
+  Value::buildTopo(topo, loss.get());
+  std::vector<double> expected;
+  for (auto node : topo) {
+    expected.push_back(node->_grad);
+    node->_grad = 0.0;
+  }
+
+  ThreadPool pool(4);
+  loss->backwardsParallel(pool);
+  for (size_t i=0; i<topo.size(); ++i) {
+    assert(std::abs(topo[i]->_grad - expected[i]) <= 1e-9 * std::max(1.0, std::abs(expected[i])));
+  }
+  assert(params[0]->_grad != 0.0);
+}
+
+void trainerTests()
+{
+  // Sharded steps match full batch steps from the same starting point
+  auto inputs = Tensor::random({ 37, 5 });
+  auto targets = Tensor::random({ 37, 2 });
+  auto model = TensorMultilayerPerceptron({ 5, 8, 2 });
+  auto reference = TensorMultilayerPerceptron({ 5, 8, 2 });
+  std::copy(model.parameterBuffer().values().begin(), model.parameterBuffer().values().end(), reference.parameterBuffer().values().begin());
+
+  // Replicas share the values, not the gradients
+  auto replica = model.replica();
+  assert(replica.parameterBuffer().values().data() == model.parameterBuffer().values().data());
+  assert(replica.parameterBuffer().grads().data() != model.parameterBuffer().grads().data());
+
+  ThreadPool pool(4);
+  auto optimizer = SGD(0.1, 0.9);
+  auto referenceOptimizer = SGD(0.1, 0.9);
+  auto trainer = DataParallelTrainer(model, optimizer, 4, pool);
+  assert(trainer.shards() == 4);
+  for (size_t i=0; i<5; ++i) {
+    const auto loss = trainer.step(inputs, targets);
+    const auto referenceLoss = reference.backwards(inputs, targets);
+    referenceOptimizer.step(reference.parameterBuffer());
+    assert(std::abs(loss - referenceLoss) < 1e-12);
+  }
+  const auto values = model.parameterBuffer().values();
+  const auto expected = reference.parameterBuffer().values();
+  for (size_t i=0; i<values.size(); ++i) {
+    assert(std::abs(values[i] - expected[i]) < 1e-12);
+  }
+
+  // A single Hogwild worker is plain SGD over the batches in order
+  auto hogwildModel = TensorMultilayerPerceptron({ 5, 8, 2 });
+  std::copy(hogwildModel.parameterBuffer().values().begin(), hogwildModel.parameterBuffer().values().end(), reference.parameterBuffer().values().begin());
+  auto sequential = HogwildTrainer(hogwildModel, 0.05, 1, 8, pool);
+  auto sgd = SGD(0.05);
+  const auto hogwildLoss = sequential.epoch(inputs, targets);
+  double referenceLoss = 0.0;
+  for (size_t first=0; first<37; first+=8) {
+    const auto last = std::min<size_t>(37, first + 8);
+    referenceLoss += reference.backwards(inputs.slice(first, last), targets.slice(first, last)) * double(last - first);
+    sgd.step(reference.parameterBuffer());
+  }
+  assert(std::abs(hogwildLoss - referenceLoss / 37) < 1e-12);
+  for (size_t i=0; i<values.size(); ++i) {
+    assert(std::abs(hogwildModel.parameterBuffer().values()[i] - expected[i]) < 1e-12);
+  }
+
+  // Concurrent workers still converge
+  auto hogwild = HogwildTrainer(hogwildModel, 0.05, 4, 2, pool);
+  assert(hogwild.workers() == 4);
+  const auto first = hogwild.epoch(inputs, targets);
+  double last = first;
+  for (size_t i=0; i<20; ++i) {
+    last = hogwild.epoch(inputs, targets);
+  }
+  assert(last < first);
+}
+
+void checkpointTests()
+{
+  auto mlp = MultilayerPerceptron({ 3, 8, 8, 8, 8, 1 });
+  const auto params = mlp.parameters();
+  auto xs = std::vector<std::vector<ValuePtr>>{
+    { Value::make(2.0), Value::make(3.0), Value::make(-1.0) },
+    { Value::make(3.0), Value::make(-1.0), Value::make(0.5)}
+  };
+  auto ys = std::vector<ValuePtr>{ Value::make(1.0), Value::make(-1.0) };
+
+  // Reference gradients from the full graph
+  auto ypred = std::vector<ValuePtr>{};
+  for (auto& x : xs) {
+    ypred.push_back(mlp(x).front());
+  }
+  auto loss = checkLoss(ys, ypred);
+  loss->backwards();
+  std::vector<Value*> fullGraph;
+  Value::buildTopo(fullGraph, loss.get());
+  std::vector<double> expected;
+  for (auto p : params) {
+    expected.push_back(p->_grad);
+    p->_grad = 0.0;
+  }
+
+  // Checkpointed: the loss graph only reaches the output boundary
+  std::vector<BasicCheckpointedForward<ValuePtr>> passes;
+  ypred.clear();
+  for (auto& x : xs) {
+    passes.push_back(mlp.checkpointed(x));
+    ypred.push_back(passes.back().outputs().front());
+  }
+  auto checkpointedLoss = checkLoss(ys, ypred);
+  assert(std::abs(checkpointedLoss->_value - loss->_value) < 1e-9);
+  std::vector<Value*> checkpointedGraph;
+  Value::buildTopo(checkpointedGraph, checkpointedLoss.get());
+  assert(checkpointedGraph.size() * 20 < fullGraph.size());
+
+  checkpointedLoss->backwards();
+  for (auto& pass : passes) {
+    pass.backwards();
+  }
+  for (size_t i=0; i<params.size(); ++i) {
+    assert(std::abs(params[i]->_grad - expected[i]) <= 1e-9 * std::max(1.0, std::abs(expected[i])));
+  }
+}
+
+void serializationTests()
+{
+  const auto directory = std::filesystem::temp_directory_path();
+  const auto path = (directory / "vsg_checkpoint_test.bin").string();
+
+  // Tensors round trip, of any layout, and load as views of one mapping
+  const auto a = Tensor::random({ 3, 4 });
+  const auto b = Tensor({ 1, 2, 3, 4, 5, 6 }, { 2, 3 }).transpose();
+  const auto c = Tensor({ 7 }, { 1 });
+  checkpoint::save(path, { a, b, c });
+  const auto loaded = checkpoint::load(path);
+  assert(loaded.size() == 3);
+  assert(loaded[0].shape() == a.shape() && loaded[1].shape() == b.shape() && loaded[2].shape() == c.shape());
+  assert(loaded[0] == a && loaded[1] == b && loaded[2] == c);
+  assert(loaded[0].sharesStorage(loaded[2]));
+
+  // Tensor models load zero-copy into their parameter buffer
+  auto model = TensorMultilayerPerceptron({ 4, 6, 2 });
+  checkpoint::save(path, model);
+  auto restored = checkpoint::loadTensorMultilayerPerceptron(path);
+  assert(restored.neuronsPerLayer() == model.neuronsPerLayer());
+  const auto input = Tensor::random({ 5, 4 });
+  assert(restored(input)->_value == model(input)->_value);
+  const auto values = restored.parameterBuffer().values();
+  assert(std::equal(values.begin(), values.end(), model.parameterBuffer().values().begin()));
+  assert(restored.parameterBuffer().valueView(0, { 1 }).sharesStorage(restored.parameterBuffer().valueView(values.size() - 1, { 1 })));
+
+  // Training the mapped model never writes back to the file
+  auto optimizer = SGD(0.1);
+  restored.backwards(input, Tensor::random({ 5, 2 }));
+  optimizer.step(restored.parameterBuffer());
+  assert(!std::equal(values.begin(), values.end(), model.parameterBuffer().values().begin()));
+  auto reloaded = checkpoint::loadTensorMultilayerPerceptron(path);
+  const auto original = model.parameterBuffer().values();
+  assert(std::equal(original.begin(), original.end(), reloaded.parameterBuffer().values().begin()));
+
+  // Layers listed in order but stored in another order are copied into place
+  const auto& parameters = model.parameterBuffer();
+  checkpoint::save(path, { parameters.valueView(30, { 6, 2 }), parameters.valueView(42, { 1, 2 }), parameters.valueView(0, { 4, 6 }), parameters.valueView(24, { 1, 6 }) });
+  {
+    // After the 32 byte preamble each rank 2 entry takes 32 bytes: list the first layer first
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    char entries[128];
+    file.seekg(32);
+    file.read(entries, sizeof(entries));
+    std::rotate(entries, entries + 64, entries + 128);
+    file.seekp(32);
+    file.write(entries, sizeof(entries));
+  }
+  auto reordered = checkpoint::loadTensorMultilayerPerceptron(path);
+  assert(reordered.neuronsPerLayer() == model.neuronsPerLayer());
+  assert(reordered(input)->_value == model(input)->_value);
+
+  // Truncated or corrupt headers are rejected before anything is read from them
+  auto rejected = [&](size_t position, auto value, size_t size) {
+    checkpoint::save(path, { a });
+    {
+      std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+      file.seekp(position);
+      file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+    std::filesystem::resize_file(path, std::min<size_t>(size, std::filesystem::file_size(path)));
+    try {
+      checkpoint::load(path);
+    } catch (const std::runtime_error&) {
+      return true;
+    }
+    return false;
+  };
+  // Rank, dims and offset of the sole entry start at byte 32, 40 and 56
+  assert(rejected(32, uint32_t(0xffffffff), SIZE_MAX));
+  assert(rejected(40, uint64_t(1) << 32, SIZE_MAX) && rejected(48, uint64_t(1) << 32, SIZE_MAX));
+  assert(rejected(56, uint64_t(-1), SIZE_MAX));
+  assert(rejected(0, checkpoint::Magic[0], 44));
+  assert(!rejected(0, checkpoint::Magic[0], SIZE_MAX));
+
+  // Scalar models copy into their parameter nodes
+  auto mlp = MultilayerPerceptron({ 3, 4, 1 });
+  checkpoint::save(path, mlp);
+  auto other = MultilayerPerceptron({ 3, 4, 1 });
+  checkpoint::load(path, other);
+  const auto x = std::vector<double>{ 0.5, -1.0, 2.0 };
+  assert(other.infer(x)[0] == mlp.infer(x)[0]);
+  auto mismatch = MultilayerPerceptron({ 3, 5, 1 });
+  bool threw = false;
+  try {
+    checkpoint::load(path, mismatch);
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  assert(threw);
+
+  // Other files are rejected
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << "not a checkpoint at all, just some text";
+  }
+  threw = false;
+  try {
+    checkpoint::load(path);
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  assert(threw);
+  std::filesystem::remove(path);
+}
+
+void datasetTests()
+{
+  const auto directory = std::filesystem::temp_directory_path();
+  const auto csvPath = (directory / "vsg_dataset_test.csv").string();
+  const auto binaryPath = (directory / "vsg_dataset_test.bin").string();
+
+  // CSV in read order: full batches, a partial last one, then the end of the epoch
+  {
+    std::ofstream out(csvPath);
+    out << "a,b,c,y\n";
+    for (int i=0; i<10; ++i) {
+      out << i << ", " << 0.5 * i << "," << -i << "," << 2 * i << "\n";
+    }
+    out << "\n";
+  }
+  {
+    auto loader = DataLoader(CsvReader(csvPath, 4, true), 3, 1, { .batchSize = 4 });
+    for (int epoch=0; epoch<2; ++epoch) {
+      size_t row = 0;
+      std::vector<size_t> sizes;
+      while (auto batch = loader.next()) {
+        const auto rows = batch->inputs.shape()[0];
+        assert(batch->inputs.shape()[1] == 3 && batch->targets.shape() == std::vector<size_t>({ rows, 1 }));
+        for (size_t r=0; r<rows; ++r, ++row) {
+          assert((batch->inputs[{ r }] == Tensor({ double(row), 0.5 * row, -double(row) }, { 3 })));
+          assert(batch->targets.data()[r] == 2.0 * row);
+        }
+        sizes.push_back(rows);
+      }
+      assert((sizes == std::vector<size_t>{ 4, 4, 2 }));
+    }
+  }
+
+  // Binary records, shuffled: every sample is seen exactly once per epoch, features with their targets
+  const auto inputs = Tensor::random({ 50, 3 });
+  const auto targets = Tensor::random({ 50, 2 });
+  writeBinary(binaryPath, inputs, targets);
+  {
+    auto loader = DataLoader(BinaryReader(binaryPath, 5), 3, 2, { .batchSize = 8, .shuffleBuffer = 16, .prefetch = 3, .seed = 7 });
+    std::vector<bool> seen(50, false);
+    bool shuffled = false;
+    size_t position = 0;
+    while (auto batch = loader.next()) {
+      for (size_t r=0; r<batch->inputs.shape()[0]; ++r, ++position) {
+        size_t match = 0;
+        while (match < 50 && !((inputs[{ match }]) == (batch->inputs[{ r }]))) {
+          ++match;
+        }
+        assert(match < 50 && !seen[match]);
+        assert(((targets[{ match }]) == (batch->targets[{ r }])));
+        seen[match] = true;
+        shuffled = shuffled || match != position;
+      }
+    }
+    assert(position == 50 && shuffled);
+  }
+
+  // Training straight from the loader
+  {
+    auto model = TensorMultilayerPerceptron({ 3, 8, 2 });
+    auto optimizer = Adam(0.01);
+    auto loader = DataLoader(BinaryReader(binaryPath, 5), 3, 2, { .batchSize = 10, .shuffleBuffer = 50 });
+    double first = 0.0;
+    double last = 0.0;
+    for (int epoch=0; epoch<50; ++epoch) {
+      double loss = 0.0;
+      while (auto batch = loader.next()) {
+        loss += model.backwards(batch->inputs, batch->targets);
+        optimizer.step(model.parameterBuffer());
+      }
+      (epoch == 0 ? first : last) = loss;
+    }
+    assert(last < first);
+  }
+
+  // Parse errors surface from next()
+  {
+    std::ofstream out(csvPath);
+    out << "1,2,3,4\n1,2,x,4\n";
+  }
+  {
+    auto loader = DataLoader(CsvReader(csvPath, 4), 3, 1, { .batchSize = 1 });
+    assert(loader.next().has_value());
+    bool threw = false;
+    try {
+      loader.next();
+    } catch (const std::runtime_error&) {
+      threw = true;
+    }
+    assert(threw);
+  }
+  std::filesystem::remove(csvPath);
+  std::filesystem::remove(binaryPath);
+}
+
+void profilerTests()
+{
+  auto mlp = MultilayerPerceptron({ 2, 3, 1 });
+  auto model = TensorMultilayerPerceptron({ 2, 3, 1 });
+  auto optimizer = SGD(0.1);
+  profiler::reset();
+  profiler::setTracing(true);
+
+  auto x = std::vector<ValuePtr>{ Value::make(1.0), Value::make(2.0) };
+  auto loss = squaredError(mlp(x).front(), Value::make(0.5));
+  loss->backwards();
+  model.backwards(Tensor::random({ 4, 2 }), Tensor::random({ 4, 1 }));
+  optimizer.step(model.parameterBuffer());
+
+  const auto stats = profiler::stats();
+  std::stringstream trace;
+  profiler::writeChromeTrace(trace);
+  profiler::setTracing(false);
+  profiler::reset();
+  if constexpr (profiler::Enabled) {
+    // 2 inputs and the target, 2 * 3 + 3 multiply-adds for the layers and the loss
+    assert(stats.nodesCreated[size_t(Operation::Null)] == 3);
+    assert(stats.nodesCreated[size_t(Operation::MultiplyAdd)] == 9);
+    assert(stats.nodesCreated[size_t(Operation::SquaredError)] == 1);
+    assert(stats.totalNodes() == 13 && stats.bytesAllocated == 13 * sizeof(Value));
+    // One scalar and one tensor graph, each sorted and backpropagated once
+    assert(stats.topoSort.count == 2 && stats.backward.count == 2);
+    assert(stats.optimizerStep.count == 1);
+    assert(stats.layerForward.size() == 2 && stats.layerForward[0].count == 2 && stats.layerForward[1].count == 2);
+    assert(trace.str().find("\"name\":\"backward\"") != std::string::npos);
+    assert(trace.str().find("\"args\":{\"layer\":1}") != std::string::npos);
+    assert(profiler::stats().totalNodes() == 0);
+  } else {
+    assert(stats.totalNodes() == 0 && stats.backward.count == 0 && stats.layerForward.empty());
+    assert(trace.str().find("\"ph\"") == std::string::npos);
+  }
+}
+
+void memoryPoolTests()
+{
+  // Size classes: freed blocks are reused by requests rounding up to the same power of two
+  MemoryPool pool(1024);
+  auto a = pool.allocate(100);
+  assert(reinterpret_cast<uintptr_t>(a) % MemoryPool::Alignment == 0);
+  pool.deallocate(a, 100);
+  assert(pool.stats().cachedBytes == 128);
+  auto b = pool.allocate(120);
+  assert(b == a && pool.stats().hits == 1 && pool.stats().misses == 1);
+  auto c = pool.allocate(10);
+  assert(c != b && pool.stats().misses == 2);
+  pool.deallocate(b, 120);
+  pool.deallocate(c, 10);
+  // Beyond the cache limit blocks go back to the system
+  auto large = pool.allocate(2048);
+  pool.deallocate(large, 2048);
+  assert(pool.stats().cachedBytes == 128 + 64);
+  pool.trim();
+  assert(pool.stats().cachedBytes == 0);
+
+  // Pooled storage is released to the pool by its last owner
+  {
+    auto storage = pool.makeShared<double>(16);
+    std::fill_n(storage.get(), 16, 1.0);
+    auto copy = storage;
+  }
+  assert(pool.stats().cachedBytes > 0);
+  pool.trim();
+
+  // Tensor storage is aligned, and steady state training is served from the cache
+  assert(reinterpret_cast<uintptr_t>(Tensor::zeros({ 3, 5 }).data().data()) % MemoryPool::Alignment == 0);
+  MemoryPool::global().resetStats();
+  assert(reinterpret_cast<uintptr_t>(Tensor(std::vector<double>(7, 1.0), { 7 }).data().data()) % MemoryPool::Alignment == 0);
+  assert(MemoryPool::global().stats().hits + MemoryPool::global().stats().misses > 0);
+  assert(reinterpret_cast<uintptr_t>(Tensor::random({ 2, 7 }).matmul(Tensor::random({ 3, 7 }).transpose()).data().data()) % MemoryPool::Alignment == 0);
+  auto model = TensorMultilayerPerceptron({ 8, 16, 4 });
+  auto optimizer = SGD(0.01);
+  const auto inputs = Tensor::random({ 32, 8 });
+  const auto targets = Tensor::random({ 32, 4 });
+  auto step = [&]() {
+    model.backwards(inputs, targets);
+    optimizer.step(model.parameterBuffer());
+  };
+  step();
+  MemoryPool::global().resetStats();
+  for (size_t i=0; i<5; ++i) {
+    step();
+  }
+  const auto stats = MemoryPool::global().stats();
+  assert(stats.misses == 0 && stats.hits > 0);
+}
+
+void reductionTests()
+{
+  // [2, 3, 4] with element i = i
+  const auto t = Tensor::generate({ 2, 3, 4 }, [](size_t i) { return double(i); });
+  assert((t.sum(0) == Tensor::generate({ 3, 4 }, [](size_t i) { return 2.0 * i + 12.0; })));
+  assert((t.sum(1) == Tensor({ 12, 15, 18, 21, 48, 51, 54, 57 }, { 2, 4 })));
+  assert((t.sum(2) == Tensor({ 6, 22, 38, 54, 70, 86 }, { 2, 3 })));
+  assert((t.sum(2, true).shape() == std::vector<size_t>{ 2, 3, 1 }));
+  assert((t.mean(1) == Tensor({ 4, 5, 6, 7, 16, 17, 18, 19 }, { 2, 4 })));
+
+  // Strided views reduce through their strides
+  const auto m = Tensor({ 3, 1, 4, 1, 5, 9 }, { 2, 3 });
+  assert((m.transpose().sum(0) == Tensor({ 8, 15 }, { 2 })));
+  assert((m.transpose().sum(1) == Tensor({ 4, 6, 13 }, { 3 })));
+  assert((m.max(0) == Tensor({ 3, 5, 9 }, { 3 })));
+  assert((m.max(1, true) == Tensor({ 4, 9 }, { 2, 1 })));
+  assert((m.argmax(1) == std::vector<size_t>{ 2, 2 }));
+  assert((m.argmax(0) == std::vector<size_t>{ 0, 1, 1 }));
+  assert(m.max() == 9.0 && m.mean() == 23.0 / 6.0);
+  assert((Tensor({ 1, 2, 3 }, { 3 }).sum(0) == Tensor({ 6 }, { 1 })));
+
+  // logsumexp is stable for inputs whose exponent overflows
+  const auto l = Tensor({ 1000, 1000, 0, std::log(3.0) }, { 2, 2 }).logsumexp(1);
+  assert(std::abs(l.data()[0] - (1000.0 + std::log(2.0))) < 1e-9);
+  assert(std::abs(l.data()[1] - std::log(4.0)) < 1e-12);
+
+  // Wide and long reductions (multiple tiles, parallel blocks) match a naive sum
+  const auto wide = Tensor::random({ 300, 130 });
+  const auto columns = wide.sum(0);
+  const auto rows = wide.sum(1);
+  for (size_t j=0; j<130; ++j) {
+    double expected = 0.0;
+    for (size_t i=0; i<300; ++i) {
+      expected += wide[{ i, j }].element();
+    }
+    assert(std::abs(columns.data()[j] - expected) < 1e-9);
+  }
+  for (size_t i=0; i<300; ++i) {
+    assert(std::abs(rows.data()[i] - wide[{ i }].sum()) < 1e-9);
+  }
+
+  // Pairwise summation keeps the error of long float sums small (a running total is off by about 1000)
+  const auto tenths = BasicTensor<float>::fill({ 1000000 }, 0.1);
+  assert(std::abs(tenths.sum() - 100000.0f) < 1.0f);
+  assert(std::abs(BasicTensor<float>::fill({ 1000, 1000 }, 0.1).sum(1).sum() - 100000.0f) < 1.0f);
+  assert(std::abs(BasicTensor<float>::fill({ 1000, 1000 }, 0.1).sum(0).sum() - 100000.0f) < 1.0f);
+}
+
+void staticMlpTests()
+{
+  // Same outputs as the inference path of the model it was imported from
+  const auto mlp = MultilayerPerceptron({ 3, 4, 4, 1 });
+  const auto model = StaticMultilayerPerceptron<3, 4, 4, 1>(mlp);
+  for (const auto& input : { std::array<double, 3>{ 0.5, -1.0, 2.0 }, std::array<double, 3>{ 0.0, 0.0, 0.0 } }) {
+    const auto expected = mlp.infer(input);
+    const auto output = model(input);
+    static_assert(std::is_same_v<decltype(output), const std::array<double, 1>>);
+    assert(std::abs(output[0] - expected[0]) < 1e-12);
+  }
+  // Weights are stored input-major
+  assert(model.layer<0>().weights[1 * 4 + 2] == mlp.layers()[0].weights()[2 * 3 + 1]->_value);
+  assert(model.layer<2>().biases[0] == mlp.layers()[2].biases()[0]->_value);
+
+  // The parameters are held inline
+  static_assert(sizeof(StaticMultilayerPerceptron<3, 4, 4, 1>) >= sizeof(double) * (4 * 4 + 5 * 4 + 5 * 1));
+  static_assert(std::is_trivially_destructible_v<StaticMultilayerPerceptron<3, 4, 4, 1>>);
+
+  // Single precision copy of the same model
+  const auto single = BasicStaticMultilayerPerceptron<float, 3, 4, 4, 1>(mlp);
+  const auto output = single({ 0.5f, -1.0f, 2.0f });
+  assert(std::abs(output[0] - mlp.infer(std::array<double, 3>{ 0.5, -1.0, 2.0 })[0]) < 1e-4);
+
+  // Layer sizes must match
+  bool threw = false;
+  try {
+    StaticMultilayerPerceptron<3, 5, 4, 1> mismatched(mlp);
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  assert(threw);
+  threw = false;
+  try {
+    StaticMultilayerPerceptron<3, 4, 1> mismatched(mlp);
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  assert(threw);
+}
+
+void inferenceServerTests()
+{
+  const auto mlp = MultilayerPerceptron({ 3, 4, 2 });
+  const std::vector<std::vector<double>> samples = { { 0.5, -1.0, 2.0 }, { 0.0, 0.0, 0.0 }, { 1.0, 2.0, 3.0 }, { -0.5, 0.25, 1.5 } };
+  {
+    // A full batch runs without waiting for the (long) deadline
+    InferenceServer server(mlp, { 4, std::chrono::seconds(10) });
+    std::vector<std::future<std::vector<double>>> results;
+    for (const auto& s : samples) {
+      results.push_back(server.submit(s));
+    }
+    for (size_t i=0; i<samples.size(); ++i) {
+      const auto output = results[i].get();
+      const auto expected = mlp.infer(samples[i]);
+      assert(output.size() == 2);
+      assert(std::abs(output[0] - expected[0]) < 1e-12 && std::abs(output[1] - expected[1]) < 1e-12);
+    }
+    const auto stats = server.stats();
+    assert(stats.requests == 4 && stats.batches == 1 && stats.largestBatch == 4);
+  }
+  std::atomic<size_t> completed{0};
+  {
+    // A lone request runs once it has waited maxDelay
+    InferenceServer server(mlp, { 32, std::chrono::milliseconds(1) });
+    auto result = server.submit(samples[0]);
+    assert(result.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+    assert(result.get().size() == 2);
+
+    // Callbacks, from concurrent clients
+    std::vector<std::thread> clients;
+    for (size_t t=0; t<4; ++t) {
+      clients.emplace_back([&, t]() {
+        for (size_t i=0; i<25; ++i) {
+          server.submit(samples[t], [&, t](std::vector<double> output, std::exception_ptr error) {
+            assert(!error && std::abs(output[1] - mlp.infer(samples[t])[1]) < 1e-12);
+            ++completed;
+          });
+        }
+      });
+    }
+    for (auto& c : clients) {
+      c.join();
+    }
+    bool threw = false;
+    try {
+      server.submit({ 1.0 });
+    } catch (const std::runtime_error&) {
+      threw = true;
+    }
+    assert(threw);
+  }
+  // Destruction completes what is still queued
+  assert(completed == 100);
+  {
+    // Batched Tensor model, and errors reaching every request of the batch
+    const auto model = TensorMultilayerPerceptron({ 3, 8, 1 });
+    InferenceServer server(model, { 2, std::chrono::milliseconds(1) });
+    auto expected = TensorMultilayerPerceptron(model)(Tensor(std::vector<double>(samples[2]), { 1, 3 }))->_value;
+    assert(std::abs(server.submit(samples[2]).get()[0] - expected[{0, 0}].element()) < 1e-12);
+
+    InferenceServer failing([](const Tensor&) -> Tensor { throw std::runtime_error("forward failed"); }, 3, 1, { 2, std::chrono::milliseconds(1) });
+    auto a = failing.submit(samples[0]);
+    auto b = failing.submit(samples[1]);
+    for (auto* f : { &a, &b }) {
+      bool threw = false;
+      try {
+        f->get();
+      } catch (const std::runtime_error&) {
+        threw = true;
+      }
+      assert(threw);
+    }
+  }
+}
+
+void quantizationTests()
+{
+  // int8 products accumulate exactly in int32, through the packed (odd k and k blocks included) and the skinny paths
+  for (auto [m, n, k] : { std::array<size_t, 3>{ 70, 50, 90 }, std::array<size_t, 3>{ 33, 40, 301 }, std::array<size_t, 3>{ 3, 40, 20 }, std::array<size_t, 3>{ 40, 3, 20 } }) {
+    std::vector<int8_t> a(m * k);
+    std::vector<int8_t> b(k * n);
+    for (size_t i=0; i<a.size(); ++i) { a[i] = int8_t(int(i * 37 % 255) - 127); }
+    for (size_t i=0; i<b.size(); ++i) { b[i] = int8_t(int(i * 91 % 255) - 127); }
+    std::vector<int32_t> c(m * n, 0);
+    std::vector<int32_t> expected(m * n, 0);
+    kernels::gemm<int8_t, int32_t>(m, n, k, a.data(), k, b.data(), n, c.data(), n);
+    kernels::gemmReference<int8_t, int32_t>(m, n, k, a.data(), k, b.data(), n, expected.data(), n);
+    assert(c == expected);
+  }
+
+  // Quantization error is at most half a step per element
+  const auto w = Tensor::random({ 20, 6 }) - 0.5;
+  const auto q = quant::quantizeColumns(w);
+  assert(q.values.size() == 120 && q.scales.size() == 6);
+  const auto restored = quant::dequantize(q);
+  for (size_t i=0; i<20; ++i) {
+    for (size_t j=0; j<6; ++j) {
+      assert(std::abs(restored[{i, j}].element() - w[{i, j}].element()) <= q.scales[j] / 2 + 1e-15);
+    }
+  }
+  const auto perTensor = quant::quantizeColumns(w, quant::Granularity::PerTensor);
+  assert(std::all_of(perTensor.scales.begin(), perTensor.scales.end(), [&](double s) { return s == perTensor.scales[0]; }));
+  assert(*std::max_element(q.scales.begin(), q.scales.end()) == perTensor.scales[0]);
+
+  // Quantized products stay close to the double ones
+  const auto x = Tensor::random({ 10, 20 });
+  const auto product = quant::matmul(x, q);
+  const auto reference = x.matmul(w);
+  for (size_t i=0; i<10; ++i) {
+    for (size_t j=0; j<6; ++j) {
+      assert(std::abs(product[{i, j}].element() - reference[{i, j}].element()) < 0.05);
+    }
+  }
+  bool threw = false;
+  try {
+    quant::matmul(Tensor::random({ 2, 3 }), q);
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  assert(threw);
+
+  // Past MaxDepth the int32 accumulator would overflow: the product is summed over blocks
+  const auto depth = 2 * quant::MaxDepth + 1000;
+  const auto ones = quant::quantizeColumns(Tensor::ones({ depth, 2 }));
+  const auto deep = quant::matmul(Tensor::ones({ 1, depth }), ones);
+  assert(std::abs(deep[{0, 0}].element() - double(depth)) < 1e-6 * depth);
+  assert(std::abs(deep[{0, 1}].element() - double(depth)) < 1e-6 * depth);
+
+  // Models: 8x smaller weights, small output error
+  const auto mlp = MultilayerPerceptron({ 16, 32, 32, 4 });
+  const auto quantized = QuantizedMultilayerPerceptron(mlp);
+  assert(quantized.numberOfInputs() == 16 && quantized.numberOfOutputs() == 4);
+  const auto samples = Tensor::random({ 50, 16 });
+  const auto report = quant::compare(mlp, quantized, samples);
+  assert(report.referenceBytes == mlp.parameters().size() * sizeof(double));
+  assert(report.quantizedBytes < report.referenceBytes / 3);
+  assert(report.maxAbsError > 0.0 && report.maxAbsError < 0.05 * report.maxAbsOutput);
+  assert(report.meanAbsError <= report.rmsError && report.rmsError <= report.maxAbsError);
+  const auto single = quantized.infer(std::vector<double>(16, 0.5));
+  const auto expected = mlp.infer(std::vector<double>(16, 0.5));
+  assert(single.size() == 4 && std::abs(single[0] - expected[0]) < 0.05 * report.maxAbsOutput);
+
+  const auto tensorModel = TensorMultilayerPerceptron({ 16, 32, 4 });
+  const auto tensorReport = quant::compare(tensorModel, QuantizedMultilayerPerceptron(tensorModel), samples);
+  assert(tensorReport.referenceBytes == tensorModel.parameterBuffer().size() * sizeof(double));
+  assert(tensorReport.maxAbsError < 0.05 * tensorReport.maxAbsOutput);
+}
+
+void parameterLayoutTests()
+{
+  // One contiguous block of parameter nodes for the whole model, layer by layer:
+  // each layer's [outputs, inputs] weight matrix followed by its biases
+  auto mlp = MultilayerPerceptron({ 3, 4, 1 });
+  const auto params = mlp.parameters();
+  assert(params.size() == (3 + 1) * 4 + (4 + 1) * 1);
+  for (size_t i=1; i<params.size(); ++i) {
+    assert(params[i].get() == params[0].get() + i);
+  }
+  const auto& first = mlp.layers().front();
+  assert(first.weights().data() == params.data() && first.weights().size() == 12);
+  assert(first.biases().data() == params.data() + 12);
+  assert(std::all_of(first.biases().begin(), first.biases().end(), [](const ValuePtr& b) { return b->_value == 0.0; }));
+  assert(mlp.layers().back().parameters().data() == params.data() + 16);
+
+  // Each neuron is its own row of the weight matrix
+  for (auto p : first.weights()) {
+    p->_value = 0.0;
+  }
+  first.weights()[4]->_value = 1.0;
+  auto x = std::vector<ValuePtr>{ Value::make(5.0), Value::make(6.0), Value::make(7.0) };
+  auto y = first(x);
+  assert(y[0]->_value == 0.0 && y[1]->_value == 6.0 && y[2]->_value == 0.0);
+
+  // Inference evaluates the same function without recording a graph
+  auto threeLayers = MultilayerPerceptron({ 3, 4, 4, 2 });
+  const auto expected = threeLayers(x);
+  const double input[] = { 5.0, 6.0, 7.0 };
+  MultilayerPerceptron::InferenceBuffers buffers;
+  const auto inferred = threeLayers.infer(input, buffers);
+  assert(inferred.size() == 2);
+  for (size_t i=0; i<inferred.size(); ++i) {
+    assert(std::abs(inferred[i] - expected[i]->_value) < 1e-12);
+  }
+  // Repeated calls reuse the scratch buffers
+  auto storage = [&]() {
+    auto result = std::array<const double*, 2>{ buffers.current.data(), buffers.next.data() };
+    std::sort(result.begin(), result.end());
+    return result;
+  };
+  const auto before = storage();
+  threeLayers.infer(input, buffers);
+  assert(storage() == before);
+  assert(std::abs(threeLayers.infer(input)[1] - expected[1]->_value) < 1e-12);
+
+  // On the tape the parameters are consecutive entries of its flat arrays
+  Tape tape;
+  Tape::Scope scope(tape);
+  auto tapeMlp = BasicMultilayerPerceptron<TapeValue>({ 2, 3, 1 });
+  assert(tape.size() == tapeMlp.parameters().size());
+  for (size_t i=0; i<tape.size(); ++i) {
+    assert(tape.values()[i] == tapeMlp.parameters()[i]->_value);
+  }
+}
+
 void nnTests1()
 {
   // prepare sample data
@@ -199,7 +1623,28 @@ void nnTests2()
 
 int main() {
   tensorTests();
+  reductionTests();
+  scalarTypeTests();
+  tensorExprTests();
+  threadPoolTests();
   engineTests();
+  arenaTests();
+  topoTests();
+  tapeTests();
+  tensorEngineTests();
+  optimizerTests();
+  parameterLayoutTests();
+  compileTests();
+  parallelBackwardTests();
+  trainerTests();
+  checkpointTests();
+  serializationTests();
+  datasetTests();
+  profilerTests();
+  memoryPoolTests();
+  staticMlpTests();
+  inferenceServerTests();
+  quantizationTests();
   nnTests1();
   nnTests2();
   return EXIT_SUCCESS;
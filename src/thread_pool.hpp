@@ -0,0 +1,187 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool of worker threads shared by the library's parallel operations
+// - Each worker owns a task deque: it pops its own tasks from the back and,
+// when empty, steals from the front of the other workers' deques
+// - The thread calling parallelFor takes part in the work, so a pool of size N
+// runs N-1 background threads and nested parallel calls always make progress
+class ThreadPool {
+  using Task = std::function<void()>;
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<Queue>> _queues;
+  std::vector<std::thread> _threads;
+  std::atomic<size_t> _pending{0};
+  std::atomic<size_t> _next{0};
+  std::atomic<bool> _stop{false};
+  std::mutex _sleepMutex;
+  std::condition_variable _wake;
+
+  bool tryPop(size_t index, Task& task) {
+    // Own queue first (LIFO), then steal from the others (FIFO)
+    for (size_t i=0; i<_queues.size(); ++i) {
+      auto& queue = *_queues[(index + i) % _queues.size()];
+      std::lock_guard lock(queue.mutex);
+      if (!queue.tasks.empty()) {
+        if (i == 0) {
+          task = std::move(queue.tasks.back());
+          queue.tasks.pop_back();
+        } else {
+          task = std::move(queue.tasks.front());
+          queue.tasks.pop_front();
+        }
+        --_pending;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  struct ThreadIdentity {
+    const ThreadPool* pool = nullptr;
+    size_t index = 0;
+  };
+  static ThreadIdentity& identity() {
+    thread_local ThreadIdentity current;
+    return current;
+  }
+
+  void run(size_t index) {
+    identity() = { this, index + 1 };
+    Task task;
+    while (true) {
+      if (tryPop(index, task)) {
+        task();
+        continue;
+      }
+      std::unique_lock lock(_sleepMutex);
+      _wake.wait(lock, [this]() { return _stop || _pending > 0; });
+      if (_stop && _pending == 0) {
+        return;
+      }
+    }
+  }
+
+  static std::unique_ptr<ThreadPool>& globalRef() {
+    static std::unique_ptr<ThreadPool> pool = std::make_unique<ThreadPool>();
+    return pool;
+  }
+public:
+  explicit ThreadPool(size_t threads = std::max<size_t>(1, std::thread::hardware_concurrency())) {
+    const auto workers = std::max<size_t>(threads, 1) - 1;
+    for (size_t i=0; i<workers; ++i) {
+      _queues.push_back(std::make_unique<Queue>());
+    }
+    for (size_t i=0; i<workers; ++i) {
+      _threads.emplace_back([this, i]() { run(i); });
+    }
+  }
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+  ~ThreadPool() {
+    {
+      std::lock_guard lock(_sleepMutex);
+      _stop = true;
+    }
+    _wake.notify_all();
+    for (auto& t : _threads) {
+      t.join();
+    }
+  }
+
+  // Number of threads taking part in parallel operations, including the caller
+  size_t size() const { return _threads.size() + 1; }
+
+  // Index in [0, size()) of the calling thread: its worker number, or 0 for threads outside this pool
+  // Distinct for all the threads taking part in one parallelFor, e.g. to index per-thread accumulators
+  size_t threadIndex() const {
+    const auto& current = identity();
+    return current.pool == this ? current.index : 0;
+  }
+
+  // Queues a task for the background workers (runs inline if there are none)
+  void submit(Task task) {
+    if (_queues.empty()) {
+      task();
+      return;
+    }
+    {
+      std::lock_guard lock(_sleepMutex);
+      ++_pending;
+    }
+    auto& queue = *_queues[_next++ % _queues.size()];
+    {
+      std::lock_guard lock(queue.mutex);
+      queue.tasks.push_back(std::move(task));
+    }
+    _wake.notify_one();
+  }
+
+  // Calls fn(chunkBegin, chunkEnd) over [begin, end) split into chunks of at least 'grain' elements
+  // Chunks are claimed dynamically by the caller and the workers; returns once all have completed
+  // 'fn' may be invoked concurrently from several threads
+  template<typename Func>
+  void parallelFor(size_t begin, size_t end, size_t grain, Func&& fn) {
+    if (end <= begin) {
+      return;
+    }
+    const auto count = end - begin;
+    const auto maxChunks = std::min((count + std::max<size_t>(grain, 1) - 1) / std::max<size_t>(grain, 1), size() * 4);
+    if (maxChunks <= 1) {
+      fn(begin, end);
+      return;
+    }
+    // Rounding the size up can leave fewer chunks than requested: recount so none starts past 'end'
+    const auto chunkSize = (count + maxChunks - 1) / maxChunks;
+    const auto chunks = (count + chunkSize - 1) / chunkSize;
+
+    struct State {
+      std::atomic<size_t> next{0};
+      std::atomic<size_t> remaining;
+    };
+    auto state = std::make_shared<State>();
+    state->remaining = chunks;
+    auto work = [state, chunks, chunkSize, begin, end, &fn]() {
+      for (auto c = state->next++; c < chunks; c = state->next++) {
+        const auto b = begin + c * chunkSize;
+        fn(b, std::min(end, b + chunkSize));
+        if (--state->remaining == 0) {
+          state->remaining.notify_all();
+        }
+      }
+    };
+    for (size_t i=0; i<std::min(chunks, size()) - 1; ++i) {
+      submit(work);
+    }
+    work();
+    for (auto r = state->remaining.load(); r != 0; r = state->remaining.load()) {
+      state->remaining.wait(r);
+    }
+  }
+
+  // Pool used by the Tensor operations
+  static ThreadPool& global() {
+    return *globalRef();
+  }
+
+  // Replaces the global pool with one of the given size (1 runs everything on the calling thread)
+  // Must not be called while parallel operations are running
+  static void setGlobalThreadCount(size_t threads) {
+    globalRef() = std::make_unique<ThreadPool>(threads);
+  }
+};
\ No newline at end of file
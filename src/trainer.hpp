@@ -0,0 +1,154 @@
+#pragma once
+
+#include "nn.hpp"
+#include "optimizer.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+// Data parallel mini-batch training of a TensorMultilayerPerceptron
+// Each step splits the batch rows into shards, one per replica of the model:
+// - Replicas share the model's parameter values but own their gradient buffers, so
+// their forward/backward passes run concurrently (on the thread pool) without contention
+// - Gradients are then all-reduced (summed over the replicas) into the model's buffer,
+// in parallel over blocks of parameters, and the optimizer updates the shared values
+// The result equals a single full batch step: each shard's loss is weighted by its share of the rows.
+template<typename Optimizer>
+class DataParallelTrainer {
+  TensorMultilayerPerceptron& _model;
+  Optimizer& _optimizer;
+  ThreadPool& _pool;
+  std::vector<TensorMultilayerPerceptron> _replicas;
+public:
+  DataParallelTrainer(TensorMultilayerPerceptron& model, Optimizer& optimizer, size_t shards, ThreadPool& pool = ThreadPool::global())
+  : _model(model), _optimizer(optimizer), _pool(pool)
+  {
+    for (size_t i=0; i<std::max<size_t>(shards, 1); ++i) {
+      _replicas.push_back(model.replica());
+    }
+  }
+
+  size_t shards() const { return _replicas.size(); }
+
+  // One optimizer step on the [batch, inputs] rows and their [batch, outputs] targets
+  // Returns the mean squared error over the batch (before the update)
+  double step(const Tensor& inputs, const Tensor& targets) {
+    const auto rows = inputs.shape().at(0);
+    if (targets.shape().at(0) != rows) {
+      throw std::runtime_error("Inputs and targets have a different number of rows");
+    }
+    const auto shards = std::min(_replicas.size(), rows);
+    std::vector<double> losses(shards, 0.0);
+    _pool.parallelFor(0, shards, 1, [&](size_t begin, size_t end) {
+      for (auto s=begin; s<end; ++s) {
+        const auto first = rows * s / shards;
+        const auto last = rows * (s + 1) / shards;
+        const auto weight = double(last - first) / double(rows);
+        auto& replica = _replicas[s];
+        auto loss = meanSquaredError(replica(inputs.slice(first, last)), TensorValue::make(targets.slice(first, last)))
+          * TensorValue::make(Tensor({ weight }, { 1 }));
+        loss->backwards();
+        losses[s] = loss->_value.element();
+      }
+    });
+
+    // All-reduce: sum every replica's gradients into the model's, leaving the replicas' zeroed
+    auto grads = _model.parameterBuffer().grads();
+    std::vector<std::span<double>> replicaGrads;
+    for (size_t s=0; s<shards; ++s) {
+      replicaGrads.push_back(_replicas[s].parameterBuffer().grads());
+    }
+    _pool.parallelFor(0, grads.size(), optim::ParallelBlock, [&](size_t begin, size_t end) {
+      for (auto& replica : replicaGrads) {
+        for (auto i=begin; i<end; ++i) {
+          grads[i] += replica[i];
+          replica[i] = 0.0;
+        }
+      }
+    });
+    _optimizer.step(_model.parameterBuffer());
+
+    double total = 0.0;
+    for (auto loss : losses) {
+      total += loss;
+    }
+    return total;
+  }
+};
+
+// Asynchronous (Hogwild) SGD on a TensorMultilayerPerceptron
+// Workers train on their own mini-batches concurrently and update the model's parameters in place,
+// without locks or a barrier between steps. Each worker:
+// - copies the shared values into its own model (relaxed atomic loads), as the forward/backward
+// kernels read their operands with plain loads
+// - runs forward/backward on its batch into its own gradient buffer
+// - subtracts learningRate * gradient from the shared values with relaxed atomic loads and stores,
+// skipping zero gradients, so workers touching disjoint parameters never write the same cache lines
+// Updates racing on the same parameter may overwrite each other: as in Hogwild this is accepted,
+// being rare when the updates are sparse and harmless to convergence otherwise.
+// Nothing else may access the model's parameters during an epoch.
+class HogwildTrainer {
+  TensorMultilayerPerceptron& _model;
+  double _learningRate;
+  size_t _batchSize;
+  ThreadPool& _pool;
+  std::vector<TensorMultilayerPerceptron> _workers;
+
+  // One SGD step of 'worker' on the [first, last) rows, returning its summed squared error
+  double step(TensorMultilayerPerceptron& worker, const Tensor& inputs, const Tensor& targets, size_t first, size_t last) {
+    auto shared = _model.parameterBuffer().values();
+    auto values = worker.parameterBuffer().values();
+    auto grads = worker.parameterBuffer().grads();
+    for (size_t i=0; i<shared.size(); ++i) {
+      values[i] = std::atomic_ref(shared[i]).load(std::memory_order_relaxed);
+    }
+    auto loss = meanSquaredError(worker(inputs.slice(first, last)), TensorValue::make(targets.slice(first, last)));
+    loss->backwards();
+    profiler::Scope scope(profiler::Phase::OptimizerStep);
+    for (size_t i=0; i<shared.size(); ++i) {
+      if (grads[i] != 0.0) {
+        std::atomic_ref value(shared[i]);
+        value.store(value.load(std::memory_order_relaxed) - _learningRate * grads[i], std::memory_order_relaxed);
+        grads[i] = 0.0;
+      }
+    }
+    return loss->_value.element() * double(last - first);
+  }
+public:
+  HogwildTrainer(TensorMultilayerPerceptron& model, double learningRate, size_t workers, size_t batchSize = 1, ThreadPool& pool = ThreadPool::global())
+  : _model(model), _learningRate(learningRate), _batchSize(std::max<size_t>(batchSize, 1)), _pool(pool)
+  {
+    for (size_t i=0; i<std::max<size_t>(workers, 1); ++i) {
+      _workers.push_back(TensorMultilayerPerceptron(model.neuronsPerLayer(), ParameterBuffer(model.parameterBuffer().size())));
+    }
+  }
+
+  size_t workers() const { return _workers.size(); }
+
+  // One pass over the [rows, inputs] samples and their [rows, outputs] targets, in batches of
+  // batchSize rows dealt round-robin to the workers
+  // Returns the mean squared error over all rows, each batch's taken before its update
+  double epoch(const Tensor& inputs, const Tensor& targets) {
+    const auto rows = inputs.shape().at(0);
+    if (targets.shape().at(0) != rows) {
+      throw std::runtime_error("Inputs and targets have a different number of rows");
+    }
+    const auto batches = (rows + _batchSize - 1) / _batchSize;
+    const auto workers = std::min(_workers.size(), batches);
+    std::vector<double> losses(workers, 0.0);
+    _pool.parallelFor(0, workers, 1, [&](size_t begin, size_t end) {
+      for (auto w=begin; w<end; ++w) {
+        for (auto b=w; b<batches; b+=workers) {
+          losses[w] += step(_workers[w], inputs, targets, b * _batchSize, std::min(rows, (b + 1) * _batchSize));
+        }
+      }
+    });
+    double total = 0.0;
+    for (auto loss : losses) {
+      total += loss;
+    }
+    return rows ? total / double(rows) : 0.0;
+  }
+};
\ No newline at end of file